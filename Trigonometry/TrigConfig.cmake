@@ -1,5 +1,7 @@
 set(TRIG_INCLUDE_DIR "/usr/include/trigonometry")
 set(TRIG_LIB_DIR "/usr/lib/trigonometry")
+# filled in by configure_file() at build time
+set(TRIG_REPORTER_PATH "@TRIG_REPORTER_PATH@")
 
 file(GLOB TRIG_FOLDERS RELATIVE "${TRIG_INCLUDE_DIR}" "${TRIG_INCLUDE_DIR}/*")
 foreach(folder ${TRIG_FOLDERS})
@@ -13,6 +15,12 @@ foreach(folder ${TRIG_FOLDERS})
                 IMPORTED_LOCATION "${libfile}"
                 INTERFACE_INCLUDE_DIRECTORIES "${TRIG_INCLUDE_DIR}/${folder}"
             )
+            if(folder STREQUAL "crash")
+                # cos.h is mostly inline, the app compiles the default reporter path too
+                set_property(TARGET Trig::crash PROPERTY
+                    INTERFACE_COMPILE_DEFINITIONS "COS_REPORTER_PATH=\"${TRIG_REPORTER_PATH}\""
+                )
+            endif()
             message(STATUS "Registered Trig module: ${folder}")
         else()
             message(WARNING "Library for folder '${folder}' not found: ${libfile}")
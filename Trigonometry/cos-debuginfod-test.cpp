@@ -0,0 +1,132 @@
+#include "cos.h"
+
+// The out-of-process debuginfod path against a stand-in server: this binary is built stripped with its
+// symbols split into cos-debuginfod-test.debug, which a stub HTTP server on 127.0.0.1 serves as
+// /buildid/<id>/debuginfo. A frame inside a static function (no .dynsym entry, so only the debug file
+// can name it) goes through the crash log's pending section and COS::resolvePendingFrames().
+// cos-debuginfod-test [debug file]: exits 0 when the frame resolved, and from the cache the second time.
+#if defined(__GLIBC__)
+namespace {
+
+struct StubServer {
+    int listenFd = -1;
+    int port = 0;
+    std::string buildId;
+    std::string debugPath;
+    std::atomic<int> hits{0};
+    std::atomic<int> misses{0};
+
+    bool start() {
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(addr);
+        if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&addr), length) != 0 ||
+            listen(listenFd, 8) != 0 || getsockname(listenFd, reinterpret_cast<sockaddr*>(&addr), &length) != 0) {
+            return false;
+        }
+        port = ntohs(addr.sin_port);
+        std::thread([this]() { serve(); }).detach();
+        return true;
+    }
+
+    void serve() {
+        for (int client; (client = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0; close(client)) {
+            std::string request;
+            char chunk[1024];
+            ssize_t n;
+            while (request.find("\r\n\r\n") == std::string::npos && (n = recv(client, chunk, sizeof(chunk), 0)) > 0) {
+                request.append(chunk, n);
+            }
+            std::ifstream file(debugPath, std::ios::binary);
+            std::string body((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            std::string wanted = "GET /buildid/" + buildId + "/debuginfo ";
+            std::string response;
+            if (request.compare(0, wanted.size(), wanted) == 0 && !body.empty()) {
+                hits++;
+                response = "HTTP/1.0 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+            } else {
+                misses++;
+                response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+            }
+            for (size_t sent = 0; sent < response.size() && (n = send(client, response.data() + sent,
+                                                                       response.size() - sent, MSG_NOSIGNAL)) > 0; ) {
+                sent += n;
+            }
+        }
+    }
+};
+
+__attribute__((noinline)) void* returnAddress() {
+    return __builtin_return_address(0);
+}
+
+// the frame to resolve: a return address inside a function only the debug file knows by name
+__attribute__((noinline)) void* strippedFrame() {
+    void* frame = returnAddress();
+    asm volatile("" ::: "memory");
+    return frame;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    void* frame = strippedFrame();
+    COSDebuginfod::Frame located = COSDebuginfod::locate(frame);
+    if (located.buildId.empty()) {
+        std::cerr << "cos-debuginfod-test: no build-id, link with --build-id" << std::endl;
+        return 1;
+    }
+
+    StubServer server;
+    server.buildId = located.buildId;
+    server.debugPath = argc > 1 ? argv[1] : located.module + ".debug";
+    char dir[] = "/tmp/cos-debuginfod-test.XXXXXX";
+    if (!mkdtemp(dir) || !server.start()) {
+        std::cerr << "cos-debuginfod-test: no temp dir or no loopback socket" << std::endl;
+        return 1;
+    }
+    std::string cacheDir = std::string(dir) + "/cache";
+    std::string logPath = std::string(dir) + "/crash.log";
+
+    // what a crash does: resolve from local debug info only and list what only the server has
+    COSDebuginfod debuginfod;
+    debuginfod.setUrls("http://127.0.0.1:" + std::to_string(server.port));
+    debuginfod.setCacheDir(cacheDir);
+    std::vector<std::string> missing;
+    std::vector<std::string> local = debuginfod.symbolize(&frame, 1, &missing);
+    char** raw = backtrace_symbols(&frame, 1);
+    std::cout << "frame:    " << (raw ? raw[0] : "?") << "\n"
+              << "local:    " << (local[0].empty() ? "unresolved" : local[0]) << "\n";
+    free(raw);
+
+    bool passed = local[0].empty() && missing.size() == 1 && server.hits == 0;
+    {
+        std::ofstream log(logPath);
+        log << "crash log stand-in\n" << COS::PENDING_SECTION << " :" << irs() << "servers: " << debuginfod.getUrls()
+            << "\ncache: " << cacheDir << "\n" << COSDebuginfod::pendingFrames(&frame, 1, missing) << irs();
+    }
+
+    // what cosec-reporter does after the crash, twice: the second run must come from the cache
+    int first = COS::resolvePendingFrames(logPath);
+    int second = COS::resolvePendingFrames(logPath);
+    std::ifstream in(logPath);
+    std::string log((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    size_t resolved = log.find("DEBUGINFO RESOLVED");
+    size_t symbol = log.find("strippedFrame", resolved);
+    std::cout << "resolved: " << first << " then " << second << " frames, server hits " << server.hits
+              << ", misses " << server.misses << "\n";
+    if (symbol != std::string::npos) {
+        std::cout << "symbol:   " << log.substr(log.rfind('\n', symbol) + 1, log.find('\n', symbol) - log.rfind('\n', symbol) - 1) << "\n";
+    }
+    passed = passed && first == 1 && second == 1 && server.hits == 1 && server.misses == 0 && symbol != std::string::npos;
+    std::cout << (passed ? "PASS" : "FAIL") << " (" << dir << ")" << std::endl;
+    return passed ? 0 : 1;
+}
+#else
+int main() {
+    std::cerr << "cos-debuginfod-test: the debuginfod client is glibc only" << std::endl;
+    return 1;
+}
+#endif
@@ -0,0 +1,165 @@
+#include "cos.h"
+
+// What the interposers cost. Heap (COS_HEAP_INTERPOSE): the same malloc+free pairs straight into glibc
+// (__libc_malloc/__libc_free), through the wrappers with the profiler idle, and sampling. Locks
+// (COS_MUTEX_INTERPOSE): uncontended lock+unlock pairs through glibc's own pthread_mutex_lock, through
+// the wrapper with the lock profiler off, and on. Built with -DTRIG_BENCHMARKS=ON against libcrash, so
+// it pays the same PLT hops an app does; a wrapper not built in is skipped.
+// cos-heap-bench [--max-idle-percent N]: exits 1 when an idle wrapper costs more than N% on any load.
+#if defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(size_t size) noexcept;
+void __libc_free(void* ptr) noexcept;
+}
+
+namespace {
+
+using AllocFn = void* (*)(size_t);
+using FreeFn = void (*)(void*);
+using LockFn = int (*)(pthread_mutex_t*);
+
+constexpr int ROUNDS = 7;
+constexpr int OPS = 2000000;
+constexpr int LIVE = 64;
+
+long long threadCpuNs() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+// called through volatile pointers, the compiler may neither drop nor merge the pairs in any mode
+AllocFn volatile allocFn;
+FreeFn volatile freeFn;
+LockFn volatile lockFn;
+pthread_mutex_t benchMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// free right away: nothing but allocator cost, the worst case for a wrapper
+double churn() {
+    uint32_t state = 12345;
+    long long began = threadCpuNs();
+    for (int i = 0; i < OPS; i++) {
+        state = state * 1664525u + 1013904223u;
+        void* p = allocFn(16 + (state >> 22));
+        freeFn(p);
+    }
+    return static_cast<double>(threadCpuNs() - began) / OPS;
+}
+
+// blocks filled and kept a while, closer to what an app does between allocations
+double work() {
+    void* live[LIVE] = {};
+    uint32_t state = 12345;
+    long long began = threadCpuNs();
+    for (int i = 0; i < OPS; i++) {
+        state = state * 1664525u + 1013904223u;
+        size_t size = 16 + (state >> 22);
+        void*& slot = live[i % LIVE];
+        freeFn(slot);
+        slot = allocFn(size);
+        std::memset(slot, i, size);
+    }
+    for (void* p : live) freeFn(p);
+    return static_cast<double>(threadCpuNs() - began) / OPS;
+}
+
+// uncontended, like nearly every lock a program takes: the wrapper's trylock always succeeds
+double lockPair() {
+    long long began = threadCpuNs();
+    for (int i = 0; i < OPS; i++) {
+        lockFn(&benchMutex);
+        pthread_mutex_unlock(&benchMutex);
+    }
+    return static_cast<double>(threadCpuNs() - began) / OPS;
+}
+
+enum Mode { Libc, Idle, Profiling, MODES };
+
+double measureHeap(double (*load)(), Mode mode) {
+    allocFn = mode == Libc ? __libc_malloc : malloc;
+    freeFn = mode == Libc ? __libc_free : free;
+    if (mode == Profiling) HeapProfiler::start(512 * 1024);
+    double ns = load();
+    if (mode == Profiling) HeapProfiler::stop();
+    return ns;
+}
+
+// glibc's own, looked up in libc itself: from here the symbol binds to the wrapper in libcrash
+LockFn libcLock() {
+    void* libc = dlopen("libc.so.6", RTLD_NOW | RTLD_NOLOAD);
+    return libc ? reinterpret_cast<LockFn>(dlsym(libc, "pthread_mutex_lock")) : nullptr;
+}
+
+double measureLock(double (*load)(), Mode mode) {
+    static const LockFn libc = libcLock();
+    lockFn = mode == Libc ? libc : pthread_mutex_lock;
+    if (mode == Profiling) LockProfiler::start();
+    double ns = load();
+    if (mode == Profiling) LockProfiler::stop();
+    return ns;
+}
+
+struct Load { const char* name; double (*run)(); };
+
+// modes interleaved per round, so frequency and cache drift hit all of them alike
+bool report(const char* title, const char* profiling, std::initializer_list<Load> loads,
+            double (*measure)(double (*)(), Mode), double maxIdlePercent) {
+    bool withinLimit = true;
+    std::cout << title << ", thread CPU time, best of " << ROUNDS << " x " << OPS << "\n"
+              << std::left << std::setw(8) << "load" << std::right << std::setw(10) << "libc"
+              << std::setw(18) << "wrapper idle" << std::setw(22) << profiling << "\n";
+    for (const Load& load : loads) {
+        double best[MODES];
+        for (double& ns : best) ns = 1e30;
+        measure(load.run, Libc);
+        for (int round = 0; round < ROUNDS; round++) {
+            for (int mode = 0; mode < MODES; mode++) {
+                best[mode] = std::min(best[mode], measure(load.run, static_cast<Mode>(mode)));
+            }
+        }
+        double idlePercent = (best[Idle] / best[Libc] - 1) * 100;
+        double profilingPercent = (best[Profiling] / best[Libc] - 1) * 100;
+        std::ostringstream idle, on;
+        idle << std::fixed << std::setprecision(1) << best[Idle] << " (" << std::showpos << idlePercent << "%)";
+        on << std::fixed << std::setprecision(1) << best[Profiling] << " (" << std::showpos << profilingPercent << "%)";
+        std::cout << std::left << std::setw(8) << load.name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << best[Libc] << std::setw(18) << idle.str() << std::setw(22) << on.str() << "\n";
+        if (maxIdlePercent >= 0 && idlePercent > maxIdlePercent) withinLimit = false;
+    }
+    return withinLimit;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double maxIdlePercent = -1;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--max-idle-percent") maxIdlePercent = std::atof(argv[i + 1]);
+    }
+    if (!HeapProfiler::interposed && !LockProfiler::interposed) {
+        std::cerr << "cos-heap-bench: no wrappers built in (COS_HEAP_INTERPOSE, COS_MUTEX_INTERPOSE)" << std::endl;
+        return 1;
+    }
+
+    bool withinLimit = true;
+    if (HeapProfiler::interposed) {
+        withinLimit &= report("ns per malloc+free", "sampling 512 KiB", {{"churn", churn}, {"work", work}},
+                              measureHeap, maxIdlePercent);
+        std::cout << "samples taken: " << HeapProfiler::getSampleCount() << "\n";
+    } else {
+        std::cout << "malloc wrappers not built in (COS_HEAP_INTERPOSE), skipped\n";
+    }
+    if (LockProfiler::interposed && libcLock()) {
+        withinLimit &= report("ns per lock+unlock", "profiler on", {{"lock", lockPair}}, measureLock, maxIdlePercent);
+    } else {
+        std::cout << "pthread_mutex_lock wrapper not built in (COS_MUTEX_INTERPOSE), skipped\n";
+    }
+    std::cout << std::flush;
+    return withinLimit ? 0 : 1;
+}
+#else
+int main() {
+    std::cerr << "cos-heap-bench: the wrappers are glibc only" << std::endl;
+    return 1;
+}
+#endif
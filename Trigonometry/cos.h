@@ -5,11 +5,28 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <cstdlib>
 #include <csignal>
 #include <chrono>
 #include <iomanip>
 #include <functional>
+#include <vector>
+#include <map>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <new>
+#include <exception>
+#include <typeinfo>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <cmath>
+#include <cctype>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -19,19 +36,88 @@
 #include <execinfo.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <link.h>
+#include <elf.h>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <ucontext.h>
+#include <semaphore.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <time.h>
+// glibc before 2.41 has the field but not the name
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#if !defined(COS_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define COS_USDT 1
+#endif
+#endif
 #endif
 inline const std::string& irs() {
     static const std::string irs = "\n\n▒▒▒█   ▒▒▒█   ▒▒▒█   █▒▒█   █▒▒▒   █▒▒▒   █▒▒▒   █▒▒▒\n\n";
     return irs;
 }
 
+// USDT probes under provider "cos" for perf, bpftrace and SystemTap, through the DTRACE_PROBEn macros of
+// sys/sdt.h (systemtap-sdt-dev), which take integer and pointer arguments only. Each is a single nop
+// until a tracer attaches; without the header, or with COS_NO_USDT, they vanish.
+#ifdef COS_USDT
+#define COS_PROBE0(name) DTRACE_PROBE(cos, name)
+#define COS_PROBE1(name, a) DTRACE_PROBE1(cos, name, a)
+#define COS_PROBE2(name, a, b) DTRACE_PROBE2(cos, name, a, b)
+#define COS_PROBE3(name, a, b, c) DTRACE_PROBE3(cos, name, a, b, c)
+#else
+#define COS_PROBE0(name) ((void)0)
+#define COS_PROBE1(name, a) ((void)0)
+#define COS_PROBE2(name, a, b) ((void)0)
+#define COS_PROBE3(name, a, b, c) ((void)0)
+#endif
+
 struct CrashInfo {
+    struct Breadcrumb {
+        std::string category;
+        uint32_t id = 0;
+        int tid = 0;
+        int64_t a = 0;
+        int64_t b = 0;
+        long long agoUs = 0;
+    };
+
     std::string signalName;
     int signalNumber;
+    int signalCode = 0;
+    std::string signalCodeName;
+    std::string faultDescription;
+    uintptr_t faultAddress = 0;
+    uintptr_t programCounter = 0;
+    uintptr_t stackPointer = 0;
+    std::vector<std::pair<std::string, uint64_t>> registers;
     std::string stackTrace;
+    std::string threadStacks;
+    int threadCount = 0;
+    long long threadCaptureUs = 0;
+    std::string exceptionType;
+    std::string exceptionWhat;
+    std::string throwSiteTrace;
+    std::string metrics;
+    std::string resourceTrend;
+    std::string lockContention;
+    std::vector<Breadcrumb> breadcrumbs;
+    std::vector<std::pair<std::string, std::string>> annotations;
     std::string timestamp;
     std::string logPath;
+    std::string snapshotPath;
     std::string logContent;
     std::string executableName;
     std::string startTime;
@@ -50,164 +136,4721 @@ struct CrashInfo {
     }
 };
 
-class COS {
+#ifndef _WIN32
+// Fetches separate debug info by build-id the way elfutils' debuginfod client does,
+// so traces from stripped binaries (libcrash included) still resolve to function names.
+// Lookup order: local cache, /usr/lib/debug/.build-id, then every server in DEBUGINFOD_URLS.
+// A failed fetch leaves an empty debuginfo file in the cache (elfutils does the same), so the
+// servers are not asked again for that build-id until it is missCacheSeconds old.
+class COSDebuginfod {
 public:
-    using CrashCallback = std::function<void(const CrashInfo&)>;
+    struct Frame {
+        std::string module;
+        std::string buildId;
+        uintptr_t offset = 0;
+    };
 
 private:
-    std::stringstream capturedOutput;
-    std::streambuf* originalCoutBuffer;
-    std::streambuf* originalCerrBuffer;
-    std::string logPath;
-    bool logSaved;
-    std::string executableName;
-    std::string startTime;
-    std::string stackTrace;
-    CrashCallback crashCallback;
+    std::vector<std::string> urls;
+    std::string cacheDir;
+    int timeoutMs;
+    int missCacheSeconds;
 
-    std::chrono::system_clock::time_point startTimePoint;
+    static std::string defaultCacheDir() {
+        if (const char* env = std::getenv("DEBUGINFOD_CACHE_PATH")) return env;
+        if (const char* xdg = std::getenv("XDG_CACHE_HOME")) return std::string(xdg) + "/debuginfod_client";
+        if (const char* home = std::getenv("HOME")) return std::string(home) + "/.cache/debuginfod_client";
+        return "/tmp/debuginfod_client";
+    }
 
-    inline static COS* globalInstance = nullptr;
+    static bool makeDirs(const std::string& path) {
+        for (size_t pos = 1; pos != std::string::npos; ) {
+            pos = path.find('/', pos + 1);
+            std::string part = path.substr(0, pos);
+            if (mkdir(part.c_str(), 0700) != 0 && errno != EEXIST) return false;
+        }
+        return true;
+    }
 
-    class TeeStreambuf : public std::streambuf {
-    private:
-        std::streambuf* console;
-        std::streambuf* captureBuffer;
+    static bool fileExists(const std::string& path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+    }
 
-    public:
-        TeeStreambuf(std::streambuf* console, std::streambuf* captureBuffer)
-            : console(console), captureBuffer(captureBuffer) {}
+    static int remainingMs(std::chrono::steady_clock::time_point deadline) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        return left > 0 ? static_cast<int>(left) : 0;
+    }
 
-    protected:
-        inline int overflow(int c) override {
-            if (c == EOF) return !EOF;
-            console->sputc(c);
-            captureBuffer->sputc(c);
-            return c;
+    static int connectTo(const std::string& host, const std::string& port,
+                         std::chrono::steady_clock::time_point deadline) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) return -1;
+
+        int fd = -1;
+        for (addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) continue;
+            if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+                // non-blocking connect: wait for writability, then read the real outcome
+                pollfd p{fd, POLLOUT, 0};
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if (errno != EINPROGRESS || poll(&p, 1, remainingMs(deadline)) <= 0 ||
+                    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+                    close(fd);
+                    fd = -1;
+                }
+            }
         }
+        freeaddrinfo(res);
+        return fd;
+    }
 
-        inline std::streamsize xsputn(const char* s, std::streamsize n) override {
-            console->sputn(s, n);
-            captureBuffer->sputn(s, n);
-            console->pubsync();
-            return n;
+    // Plain HTTP/1.0 GET straight into a file; https servers need a proxy in front.
+    static bool httpGet(const std::string& url, const std::string& outPath,
+                        std::chrono::steady_clock::time_point deadline) {
+        if (url.compare(0, 7, "http://") != 0) return false;
+        std::string rest = url.substr(7);
+        size_t slash = rest.find('/');
+        std::string hostPort = rest.substr(0, slash);
+        std::string path = slash == std::string::npos ? "/" : rest.substr(slash);
+        std::string host = hostPort, port = "80";
+        size_t colon = hostPort.rfind(':');
+        if (colon != std::string::npos && hostPort.find(']', colon) == std::string::npos) {
+            host = hostPort.substr(0, colon);
+            port = hostPort.substr(colon + 1);
         }
-    };
+        if (host.size() > 1 && host.front() == '[') host = host.substr(1, host.size() - 2);
 
-    TeeStreambuf* coutBuffer;
-    TeeStreambuf* cerrBuffer;
+        int fd = connectTo(host, port, deadline);
+        if (fd < 0) return false;
 
-    inline std::string getTimestampForFilename() const {
-        auto now = std::chrono::system_clock::now();
-        auto time = std::chrono::system_clock::to_time_t(now);
-        std::tm tm;
+        std::string request = "GET " + path + " HTTP/1.0\r\nHost: " + hostPort +
+                              "\r\nUser-Agent: COS\r\nConnection: close\r\n\r\n";
+        size_t sent = 0;
+        while (sent < request.size()) {
+            pollfd p{fd, POLLOUT, 0};
+            if (poll(&p, 1, remainingMs(deadline)) <= 0) { close(fd); return false; }
+            ssize_t n = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0 && errno != EAGAIN) { close(fd); return false; }
+            if (n > 0) sent += n;
+        }
 
-#ifdef _WIN32
-        localtime_s(&tm, &time);
-#else
-        localtime_r(&time, &tm);
+        std::ofstream out(outPath, std::ios::binary | std::ios::trunc);
+        std::string header;
+        bool inBody = false;
+        long long expected = -1, received = 0;
+        char chunk[16384];
+        while (true) {
+            pollfd p{fd, POLLIN, 0};
+            if (poll(&p, 1, remainingMs(deadline)) <= 0) { close(fd); return false; }
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EAGAIN) continue;
+            if (n <= 0) break;
+            if (inBody) {
+                out.write(chunk, n);
+                received += n;
+                continue;
+            }
+            header.append(chunk, n);
+            size_t end = header.find("\r\n\r\n");
+            if (end == std::string::npos) continue;
+            if (header.compare(0, 5, "HTTP/") != 0 || header.find(" 200 ") > header.find("\r\n")) {
+                close(fd);
+                return false;
+            }
+            std::string lower = header.substr(0, end);
+            for (char& ch : lower) ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+            size_t cl = lower.find("\r\ncontent-length:");
+            if (cl != std::string::npos) expected = std::atoll(lower.c_str() + cl + 17);
+            out.write(header.data() + end + 4, header.size() - end - 4);
+            received = static_cast<long long>(header.size() - end - 4);
+            inBody = true;
+        }
+        close(fd);
+        out.close();
+        return inBody && received > 0 && (expected < 0 || expected == received) && out;
+    }
+
+    static int phdrCallback(dl_phdr_info* info, size_t, void* data) {
+        auto* query = static_cast<std::pair<uintptr_t, Frame*>*>(data);
+        uintptr_t addr = query->first;
+        bool inside = false;
+        for (int i = 0; i < info->dlpi_phnum && !inside; i++) {
+            const ElfW(Phdr)& ph = info->dlpi_phdr[i];
+            uintptr_t start = info->dlpi_addr + ph.p_vaddr;
+            inside = ph.p_type == PT_LOAD && addr >= start && addr < start + ph.p_memsz;
+        }
+        if (!inside) return 0;
+
+        Frame* frame = query->second;
+        frame->module = info->dlpi_name ? info->dlpi_name : "";
+        frame->offset = addr - info->dlpi_addr;
+
+        for (int i = 0; i < info->dlpi_phnum; i++) {
+            const ElfW(Phdr)& ph = info->dlpi_phdr[i];
+            if (ph.p_type != PT_NOTE) continue;
+            const char* note = reinterpret_cast<const char*>(info->dlpi_addr + ph.p_vaddr);
+            const char* end = note + ph.p_memsz;
+            while (note + sizeof(ElfW(Nhdr)) <= end) {
+                auto* nh = reinterpret_cast<const ElfW(Nhdr)*>(note);
+                const char* name = note + sizeof(ElfW(Nhdr));
+                const unsigned char* desc = reinterpret_cast<const unsigned char*>(
+                    name + ((nh->n_namesz + 3) & ~3u));
+                if (nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 && std::memcmp(name, "GNU", 4) == 0) {
+                    static const char hex[] = "0123456789abcdef";
+                    for (unsigned j = 0; j < nh->n_descsz; j++) {
+                        frame->buildId += hex[desc[j] >> 4];
+                        frame->buildId += hex[desc[j] & 0xf];
+                    }
+                    return 1;
+                }
+                note = reinterpret_cast<const char*>(desc) + ((nh->n_descsz + 3) & ~3u);
+            }
+        }
+        return 1;
+    }
+
+    static std::string symbolFromElf(const std::string& path, uintptr_t vaddr, uintptr_t lookupBias) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return "";
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(ElfW(Ehdr)))) {
+            close(fd);
+            return "";
+        }
+        size_t size = static_cast<size_t>(st.st_size);
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return "";
+
+        const char* base = static_cast<const char*>(map);
+        auto* eh = reinterpret_cast<const ElfW(Ehdr)*>(base);
+        std::string result;
+        const unsigned char nativeClass = sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32;
+        if (std::memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0 && eh->e_ident[EI_CLASS] == nativeClass &&
+            eh->e_shoff + static_cast<size_t>(eh->e_shnum) * sizeof(ElfW(Shdr)) <= size) {
+            auto* sh = reinterpret_cast<const ElfW(Shdr)*>(base + eh->e_shoff);
+            // .symtab carries the static functions a stripped build lost; .dynsym is the fallback
+            for (unsigned type : {SHT_SYMTAB, SHT_DYNSYM}) {
+                for (int i = 0; i < eh->e_shnum && result.empty(); i++) {
+                    if (sh[i].sh_type != type || sh[i].sh_link >= eh->e_shnum) continue;
+                    const ElfW(Shdr)& strs = sh[sh[i].sh_link];
+                    if (sh[i].sh_offset + sh[i].sh_size > size || strs.sh_offset + strs.sh_size > size) continue;
+                    auto* syms = reinterpret_cast<const ElfW(Sym)*>(base + sh[i].sh_offset);
+                    size_t count = sh[i].sh_size / sizeof(ElfW(Sym));
+                    for (size_t s = 0; s < count; s++) {
+                        if (ELF64_ST_TYPE(syms[s].st_info) != STT_FUNC || syms[s].st_name >= strs.sh_size) continue;
+                        uintptr_t start = syms[s].st_value;
+                        uintptr_t lookup = vaddr - lookupBias;
+                        if (lookup < start || lookup >= start + (syms[s].st_size ? syms[s].st_size : 1)) continue;
+                        const char* name = base + strs.sh_offset + syms[s].st_name;
+                        int status = 0;
+                        char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+                        char off[32];
+                        snprintf(off, sizeof(off), "+0x%lx", static_cast<unsigned long>(vaddr - start));
+                        result = std::string(status == 0 && demangled ? demangled : name) + off;
+                        free(demangled);
+                        break;
+                    }
+                }
+                if (!result.empty()) break;
+            }
+        }
+        munmap(map, size);
+        return result;
+    }
+
+    bool recentlyFailed(const std::string& buildId) const {
+        struct stat st;
+        std::string marker = cacheDir + "/" + buildId + "/debuginfo";
+        return stat(marker.c_str(), &st) == 0 && st.st_size == 0 && time(nullptr) - st.st_mtime < missCacheSeconds;
+    }
+
+public:
+    COSDebuginfod() : cacheDir(defaultCacheDir()), timeoutMs(5000), missCacheSeconds(600) {
+        if (const char* env = std::getenv("DEBUGINFOD_URLS")) setUrls(env);
+        if (const char* env = std::getenv("DEBUGINFOD_TIMEOUT")) {
+            int seconds = std::atoi(env);
+            if (seconds > 0) timeoutMs = seconds * 1000;
+        }
+    }
+
+    // Space separated, same as DEBUGINFOD_URLS
+    inline void setUrls(const std::string& list) {
+        urls.clear();
+        std::istringstream iss(list);
+        for (std::string url; iss >> url; ) {
+            while (!url.empty() && url.back() == '/') url.pop_back();
+            urls.push_back(url);
+        }
+    }
+
+    inline void setCacheDir(const std::string& dir) { cacheDir = dir; }
+    inline void setTimeout(int ms) { timeoutMs = ms; }
+    inline void setMissCacheSeconds(int seconds) { missCacheSeconds = seconds; }
+    inline bool hasServers() const { return !urls.empty(); }
+    inline const std::string& getCacheDir() const { return cacheDir; }
+
+    inline std::string getUrls() const {
+        std::string list;
+        for (const std::string& url : urls) list += (list.empty() ? "" : " ") + url;
+        return list;
+    }
+
+    static Frame locate(const void* addr) {
+        Frame frame;
+        std::pair<uintptr_t, Frame*> query(reinterpret_cast<uintptr_t>(addr), &frame);
+        dl_iterate_phdr(phdrCallback, &query);
+        if (frame.module.empty() && !frame.buildId.empty()) {
+            char path[PATH_MAX];
+            ssize_t count = readlink("/proc/self/exe", path, sizeof(path) - 1);
+            if (count > 0) frame.module.assign(path, count);
+        }
+        return frame;
+    }
+
+    std::string cachedPath(const std::string& buildId) const {
+        std::string cached = cacheDir + "/" + buildId + "/debuginfo";
+        if (fileExists(cached)) return cached;
+        if (buildId.size() > 2) {
+            std::string system = "/usr/lib/debug/.build-id/" + buildId.substr(0, 2) + "/" + buildId.substr(2) + ".debug";
+            if (fileExists(system)) return system;
+        }
+        return "";
+    }
+
+    std::string fetch(const std::string& buildId, std::chrono::steady_clock::time_point deadline) const {
+        std::string found = cachedPath(buildId);
+        if (!found.empty() || urls.empty() || recentlyFailed(buildId)) return found;
+
+        std::string dir = cacheDir + "/" + buildId;
+        if (!makeDirs(dir)) return "";
+        std::string target = dir + "/debuginfo";
+        std::string temp = dir + "/.debuginfo." + std::to_string(getpid()) + "." +
+                           std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        for (const std::string& url : urls) {
+            if (httpGet(url + "/buildid/" + buildId + "/debuginfo", temp, deadline)) {
+                // rename keeps concurrent readers from ever seeing a half-written file
+                if (rename(temp.c_str(), target.c_str()) == 0) return target;
+            }
+            unlink(temp.c_str());
+            if (remainingMs(deadline) == 0) break;
+        }
+        int marker = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (marker >= 0) close(marker);
+        return "";
+    }
+
+    // One worker per distinct build-id; all share a single deadline so the total wait is bounded.
+    std::vector<std::string> fetchAll(const std::vector<std::string>& buildIds) const {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        std::vector<std::string> paths(buildIds.size());
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < buildIds.size(); i++) {
+            paths[i] = cachedPath(buildIds[i]);
+            if (!paths[i].empty() || urls.empty() || recentlyFailed(buildIds[i])) continue;
+            try {
+                workers.emplace_back([this, &buildIds, &paths, i, deadline]() {
+                    paths[i] = fetch(buildIds[i], deadline);
+                });
+            } catch (const std::system_error&) {
+                paths[i] = fetch(buildIds[i], deadline);
+            }
+        }
+        for (std::thread& worker : workers) worker.join();
+        return paths;
+    }
+
+    // Returns one line per frame in backtrace_symbols() layout, empty where nothing resolved.
+    // With `missing`, nothing is fetched: build-ids only a server could supply are appended to it instead.
+    std::vector<std::string> symbolize(void* const* addrs, int count, std::vector<std::string>* missing = nullptr) const {
+        std::vector<Frame> frames;
+        std::vector<std::string> ids;
+        for (int i = 0; i < count; i++) {
+            frames.push_back(locate(addrs[i]));
+            const std::string& id = frames.back().buildId;
+            if (!id.empty() && std::find(ids.begin(), ids.end(), id) == ids.end()) ids.push_back(id);
+        }
+
+        std::vector<std::string> paths;
+        if (missing) {
+            for (const std::string& id : ids) {
+                paths.push_back(cachedPath(id));
+                if (paths.back().empty() && !urls.empty() && !recentlyFailed(id) &&
+                    std::find(missing->begin(), missing->end(), id) == missing->end()) {
+                    missing->push_back(id);
+                }
+            }
+        } else {
+            paths = fetchAll(ids);
+        }
+        std::vector<std::string> lines(count);
+        for (int i = 0; i < count; i++) {
+            const Frame& frame = frames[i];
+            auto it = std::find(ids.begin(), ids.end(), frame.buildId);
+            if (it == ids.end() || paths[it - ids.begin()].empty()) continue;
+
+            // return addresses point past the call; step back so the lookup lands inside it
+            std::string symbol = symbolFromElf(paths[it - ids.begin()], frame.offset, i > 0 ? 1 : 0);
+            if (symbol.empty()) continue;
+            char addr[32];
+            snprintf(addr, sizeof(addr), "%p", addrs[i]);
+            lines[i] = frame.module + "(" + symbol + ") [" + addr + "]";
+        }
+        return lines;
+    }
+
+    // What a crash leaves for an out-of-process fetch: one "<build-id> 0x<offset> <module>" line per
+    // distinct frame whose build-id is in `buildIds`; offsets are the ones backtrace_symbols() prints
+    static std::string pendingFrames(void* const* addrs, int count, const std::vector<std::string>& buildIds) {
+        std::string list;
+        for (int i = 0; i < count; i++) {
+            Frame frame = locate(addrs[i]);
+            if (std::find(buildIds.begin(), buildIds.end(), frame.buildId) == buildIds.end()) continue;
+            char offset[32];
+            snprintf(offset, sizeof(offset), " 0x%lx ", static_cast<unsigned long>(frame.offset));
+            std::string line = frame.buildId + offset + frame.module + "\n";
+            if (list.find(line) == std::string::npos) list += line;
+        }
+        return list;
+    }
+
+    // Fetches the build-ids of a pendingFrames() list under one deadline and returns one
+    // "<module>(+0x<offset>) = <symbol>" line per frame that resolved, to match against the raw trace
+    std::string resolvePending(const std::string& list, size_t* fetched = nullptr) const {
+        std::vector<Frame> frames;
+        std::vector<std::string> ids;
+        std::istringstream lines(list);
+        for (std::string line; std::getline(lines, line); ) {
+            std::istringstream fields(line);
+            Frame frame;
+            std::string offset;
+            if (!(fields >> frame.buildId >> offset) || offset.compare(0, 2, "0x") != 0) continue;
+            frame.offset = static_cast<uintptr_t>(std::strtoull(offset.c_str() + 2, nullptr, 16));
+            std::getline(fields >> std::ws, frame.module);
+            frames.push_back(frame);
+            if (std::find(ids.begin(), ids.end(), frame.buildId) == ids.end()) ids.push_back(frame.buildId);
+        }
+
+        std::vector<std::string> paths = fetchAll(ids);
+        if (fetched) *fetched = ids.size() - std::count(paths.begin(), paths.end(), std::string());
+        std::string resolved;
+        for (const Frame& frame : frames) {
+            const std::string& path = paths[std::find(ids.begin(), ids.end(), frame.buildId) - ids.begin()];
+            // all but the innermost frame are return addresses, which is nearly every one of them
+            std::string symbol = path.empty() ? "" : symbolFromElf(path, frame.offset, 1);
+            if (symbol.empty()) continue;
+            char offset[32];
+            snprintf(offset, sizeof(offset), "(+0x%lx) = ", static_cast<unsigned long>(frame.offset));
+            resolved += frame.module + offset + symbol + "\n";
+        }
+        return resolved;
+    }
+};
 #endif
 
-        std::ostringstream oss;
-        oss << std::put_time(&tm, "%Y-%m-%d_%H-%M-%S");
-        return oss.str();
+#ifndef _WIN32
+// Compact binary crash record written next to the .log: registers, frames, the stack
+// above the stack pointer and /proc/self/maps, hard capped at a few dozen KiB.
+// The writer is async-signal-safe (static buffers, raw syscalls); load() is the reader.
+class CrashSnapshot {
+public:
+    enum StreamType : uint32_t { Registers = 1, Frames = 2, Stack = 3, Maps = 4 };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t streamCount;
+        int32_t signalNumber;
+        int32_t signalCode;
+        uint64_t faultAddress;
+        uint64_t timestampMs;
+        uint32_t pid;
+        uint32_t tid;
+    };
+
+    struct StreamHeader {
+        uint32_t type;
+        uint32_t size;
+        uint64_t base;
+    };
+
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t MAPS_BUFFER = 64 * 1024;
+
+    Header header{};
+    std::vector<uint64_t> registers;
+    std::vector<uint64_t> frames;
+    uint64_t stackBase = 0;
+    std::string stack;
+    std::string maps;
+
+private:
+    struct Writer {
+        int fd;
+        size_t limit;
+        size_t written;
+
+        bool put(const void* data, size_t size) {
+            if (written + size > limit) return false;
+            const char* p = static_cast<const char*>(data);
+            size_t left = size;
+            while (left > 0) {
+                ssize_t n = ::write(fd, p, left);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                p += n;
+                left -= static_cast<size_t>(n);
+            }
+            written += size;
+            return true;
+        }
+
+        // Clips the payload to what still fits under the cap; returns false once nothing does
+        bool stream(uint32_t type, uint64_t base, const void* data, size_t size) {
+            if (written + sizeof(StreamHeader) >= limit) return false;
+            size_t room = limit - written - sizeof(StreamHeader);
+            StreamHeader sh{type, static_cast<uint32_t>(size < room ? size : room), base};
+            return put(&sh, sizeof(sh)) && put(data, sh.size);
+        }
+    };
+
+    // Upper end of the mapping that holds sp, so the stack copy never reads past it
+    static uint64_t mappingEnd(const char* maps, size_t size, uint64_t sp) {
+        const char* p = maps;
+        const char* end = maps + size;
+        while (p < end) {
+            uint64_t lo = 0, hi = 0;
+            while (p < end && *p != '-') lo = lo * 16 + static_cast<uint64_t>(hexValue(*p++));
+            if (p < end) p++;
+            while (p < end && *p != ' ') hi = hi * 16 + static_cast<uint64_t>(hexValue(*p++));
+            if (sp >= lo && sp < hi) return hi;
+            while (p < end && *p != '\n') p++;
+            p++;
+        }
+        return 0;
     }
 
-    inline std::string getTimestampForLog() const {
-        auto now = std::chrono::system_clock::now();
-        auto time = std::chrono::system_clock::to_time_t(now);
-        std::tm tm;
+    static int hexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return 0;
+    }
 
-#ifdef _WIN32
-        localtime_s(&tm, &time);
+public:
+    static uint64_t stackPointerOf(const ucontext_t* uc) {
+#if defined(__x86_64__)
+        return static_cast<uint64_t>(uc->uc_mcontext.gregs[REG_RSP]);
+#elif defined(__i386__)
+        return static_cast<uint64_t>(uc->uc_mcontext.gregs[REG_ESP]);
+#elif defined(__aarch64__)
+        return uc->uc_mcontext.sp;
 #else
-        localtime_r(&time, &tm);
+        (void)uc;
+        return 0;
 #endif
+    }
 
-        std::ostringstream oss;
-        oss << std::put_time(&tm, "%Y/%m/%d %H:%M:%S");
-        return oss.str();
+    static uint64_t programCounterOf(const ucontext_t* uc) {
+#if defined(__x86_64__)
+        return static_cast<uint64_t>(uc->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__i386__)
+        return static_cast<uint64_t>(uc->uc_mcontext.gregs[REG_EIP]);
+#elif defined(__aarch64__)
+        return uc->uc_mcontext.pc;
+#else
+        (void)uc;
+        return 0;
+#endif
     }
 
-    std::string getExecutableNameInternal() const {
-#ifdef _WIN32
-        char path[MAX_PATH];
-        GetModuleFileNameA(NULL, path, MAX_PATH);
-        std::string fullPath(path);
-        size_t pos = fullPath.find_last_of("\\/");
-        std::string exeName = (pos == std::string::npos) ? fullPath : fullPath.substr(pos + 1);
-        size_t extPos = exeName.find_last_of('.');
-        if (extPos != std::string::npos) {
-            exeName = exeName.substr(0, extPos);
+    // General registers in registerName() order
+    static size_t registersOf(const ucontext_t* uc, uint64_t* out, size_t max) {
+        size_t count = 0;
+#if defined(__x86_64__) || defined(__i386__)
+        for (; count < NGREG && count < max; count++) {
+            out[count] = static_cast<uint64_t>(uc->uc_mcontext.gregs[count]);
         }
-        return exeName;
-#else
-        char path[PATH_MAX];
-        ssize_t count = readlink("/proc/self/exe", path, PATH_MAX);
-        if (count != -1) {
-            path[count] = '\0';
-            std::string fullPath(path);
-            size_t pos = fullPath.find_last_of('/');
-            return (pos == std::string::npos) ? fullPath : fullPath.substr(pos + 1);
+#elif defined(__aarch64__)
+        for (; count < 31 && count < max; count++) out[count] = uc->uc_mcontext.regs[count];
+        if (count + 3 <= max) {
+            out[count++] = uc->uc_mcontext.sp;
+            out[count++] = uc->uc_mcontext.pc;
+            out[count++] = uc->uc_mcontext.pstate;
         }
-        return "app";
+#else
+        (void)uc;
+        (void)out;
+        (void)max;
 #endif
+        return count;
     }
 
-    inline std::string getTempDir() const {
-        std::string appid = executableName;
-        std::string timestamp = getTimestampForFilename();
+    static size_t write(const char* path, size_t limit, int signalNumber, int signalCode,
+                        const void* faultAddress, const ucontext_t* uc,
+                        void* const* frameAddrs, int frameCount) {
+        static char mapsBuffer[MAPS_BUFFER];
+        size_t mapsSize = 0;
+        int mapsFd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+        if (mapsFd >= 0) {
+            ssize_t n;
+            while (mapsSize < sizeof(mapsBuffer) &&
+                   (n = read(mapsFd, mapsBuffer + mapsSize, sizeof(mapsBuffer) - mapsSize)) > 0) {
+                mapsSize += static_cast<size_t>(n);
+            }
+            close(mapsFd);
+        }
 
-#ifdef _WIN32
-        const char* tempDir = std::getenv("TEMP");
-        if (!tempDir) tempDir = std::getenv("TMP");
-        if (!tempDir) tempDir = "C:\\Temp";
-        return std::string(tempDir) + "\\" + appid + "_" + timestamp + ".log";
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) return 0;
+        Writer out{fd, limit, 0};
+
+        timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        Header h{};
+        std::memcpy(h.magic, "COSDUMP\0", 8);
+        h.version = VERSION;
+        h.streamCount = 4;
+        h.signalNumber = signalNumber;
+        h.signalCode = signalCode;
+        h.faultAddress = reinterpret_cast<uintptr_t>(faultAddress);
+        h.timestampMs = static_cast<uint64_t>(now.tv_sec) * 1000 + static_cast<uint64_t>(now.tv_nsec / 1000000);
+        h.pid = static_cast<uint32_t>(getpid());
+        h.tid = static_cast<uint32_t>(syscall(SYS_gettid));
+        out.put(&h, sizeof(h));
+
+        uint64_t regs[64] = {};
+        size_t regCount = registersOf(uc, regs, 64);
+        out.stream(Registers, 0, regs, regCount * sizeof(uint64_t));
+
+        uint64_t pcs[256];
+        int count = frameCount < 256 ? frameCount : 256;
+        for (int i = 0; i < count; i++) pcs[i] = reinterpret_cast<uintptr_t>(frameAddrs[i]);
+        out.stream(Frames, 0, pcs, static_cast<size_t>(count) * sizeof(uint64_t));
+
+        // the stack gets half of what is left, the maps the remainder
+        uint64_t sp = stackPointerOf(uc);
+        uint64_t top = mappingEnd(mapsBuffer, mapsSize, sp);
+        size_t stackBytes = top > sp ? static_cast<size_t>(top - sp) : 0;
+        size_t budget = out.written < limit ? (limit - out.written) / 2 : 0;
+        if (stackBytes > budget) stackBytes = budget;
+        out.stream(Stack, sp, reinterpret_cast<const void*>(static_cast<uintptr_t>(sp)), stackBytes);
+
+        out.stream(Maps, 0, mapsBuffer, mapsSize);
+
+        close(fd);
+        return out.written;
+    }
+
+    static bool load(const std::string& path, CrashSnapshot& snapshot) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.read(reinterpret_cast<char*>(&snapshot.header), sizeof(Header)) ||
+            std::memcmp(snapshot.header.magic, "COSDUMP\0", 8) != 0 ||
+            snapshot.header.version != VERSION) {
+            return false;
+        }
+
+        in.seekg(0, std::ios::end);
+        std::streamoff fileSize = in.tellg();
+        in.seekg(sizeof(Header));
+
+        StreamHeader sh;
+        while (in.read(reinterpret_cast<char*>(&sh), sizeof(sh))) {
+            // a corrupt size must not turn into a huge allocation
+            if (sh.size > static_cast<uint64_t>(fileSize - in.tellg())) break;
+            std::string data(sh.size, '\0');
+            if (!in.read(&data[0], sh.size)) break;
+            switch (sh.type) {
+            case Registers:
+                snapshot.registers.resize(sh.size / sizeof(uint64_t));
+                std::memcpy(snapshot.registers.data(), data.data(), snapshot.registers.size() * sizeof(uint64_t));
+                break;
+            case Frames:
+                snapshot.frames.resize(sh.size / sizeof(uint64_t));
+                std::memcpy(snapshot.frames.data(), data.data(), snapshot.frames.size() * sizeof(uint64_t));
+                break;
+            case Stack:
+                snapshot.stackBase = sh.base;
+                snapshot.stack = std::move(data);
+                break;
+            case Maps:
+                snapshot.maps = std::move(data);
+                break;
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+
+    static const char* registerName(size_t index) {
+#if defined(__x86_64__)
+        static const char* names[] = {"r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+                                      "rdi", "rsi", "rbp", "rbx", "rdx", "rax", "rcx", "rsp",
+                                      "rip", "eflags", "csgsfs", "err", "trapno", "oldmask", "cr2"};
+        return index < sizeof(names) / sizeof(names[0]) ? names[index] : "?";
+#elif defined(__aarch64__)
+        static const char* names[] = {"x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9",
+                                      "x10", "x11", "x12", "x13", "x14", "x15", "x16", "x17", "x18", "x19",
+                                      "x20", "x21", "x22", "x23", "x24", "x25", "x26", "x27", "x28", "x29",
+                                      "x30", "sp", "pc", "pstate"};
+        return index < sizeof(names) / sizeof(names[0]) ? names[index] : "?";
 #else
-        return "/tmp/" + appid + "_" + timestamp + ".log";
+        (void)index;
+        return "reg";
 #endif
     }
 
+    std::string describe(size_t stackWords = 32) const {
+        std::ostringstream oss;
+        oss << "Signal: " << header.signalNumber << " (code " << header.signalCode << ")\n"
+            << "Fault address: 0x" << std::hex << header.faultAddress << std::dec << "\n"
+            << "Pid/Tid: " << header.pid << "/" << header.tid << "\n\nRegisters:\n";
+        for (size_t i = 0; i < registers.size(); i++) {
+            oss << std::setw(8) << registerName(i) << " 0x" << std::hex << std::setw(16)
+                << std::setfill('0') << registers[i] << std::setfill(' ') << std::dec
+                << ((i % 3 == 2) ? "\n" : "  ");
+        }
+        oss << "\n\nFrames:\n";
+        for (size_t i = 0; i < frames.size(); i++) {
+            oss << "#" << i << " 0x" << std::hex << frames[i] << std::dec << "\n";
+        }
+        oss << "\nStack (" << stack.size() << " bytes from 0x" << std::hex << stackBase << "):\n";
+        for (size_t i = 0; i + sizeof(uint64_t) <= stack.size() && i / sizeof(uint64_t) < stackWords; i += sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, stack.data() + i, sizeof(word));
+            oss << "0x" << (stackBase + i) << ": 0x" << std::setw(16) << std::setfill('0') << word
+                << std::setfill(' ') << "\n";
+        }
+        oss << std::dec << "\nMaps:\n" << maps;
+        return oss.str();
+    }
+};
+#endif
+
 #ifndef _WIN32
-    std::string captureStackTrace() const {
-        const int MAX_FRAMES = 64;
+// Sampling heap profiler. The COS_HEAP_INTERPOSE malloc/free wrappers feed it; an allocation is sampled
+// once its thread has allocated a random, exponentially distributed number of bytes (mean sampleBytes),
+// so big allocations are caught more often and the fast path is one thread-local subtraction.
+// Sampled blocks live in a lock-free open-addressing table; a small counting filter keeps free() of
+// unsampled blocks (nearly all of them) from touching it.
+class HeapProfiler {
+public:
+    static constexpr int MAX_FRAMES = 24;
+    static constexpr size_t SITE_SLOTS = 4096;
+    static constexpr size_t LIVE_SLOTS = 1 << 16;
+    static constexpr size_t FILTER_SLOTS = 1 << 15;
 
-        void* buffer[MAX_FRAMES];
-        int numFrames = backtrace(buffer, MAX_FRAMES);
+    struct Site {
+        std::atomic<uint64_t> hash;
+        std::atomic<int> ready;
+        int depth;
+        void* frames[MAX_FRAMES];
+        std::atomic<int64_t> liveBytes;
+        std::atomic<int64_t> liveCount;
+        std::atomic<int64_t> totalBytes;
+        std::atomic<int64_t> totalCount;
+    };
 
-        std::stringstream ss;
-        char** symbols = backtrace_symbols(buffer, numFrames);
+    struct SiteStats {
+        int64_t liveBytes;
+        int64_t liveCount;
+        int64_t totalBytes;
+        int64_t totalCount;
+        int depth;
+        void* frames[MAX_FRAMES];
+    };
 
-        if (symbols) {
-            for (int i = 0; i < numFrames; i++) {
-                ss << symbols[i] << "\n";
+private:
+    // Slot ptr: 0 empty, 1 deleted, 2 being filled, anything else a sampled block
+    struct Live {
+        std::atomic<uintptr_t> ptr;
+        uint32_t site;
+        int64_t bytes;
+        int64_t count;
+    };
+
+    struct Tables {
+        Site sites[SITE_SLOTS];
+        Live live[LIVE_SLOTS];
+        std::atomic<uint8_t> filter[FILTER_SLOTS];
+    };
+
+    inline static Tables* tables = nullptr;
+    inline static std::atomic<bool> active{false};
+    inline static size_t sampleBytes = 512 * 1024;
+    inline static std::atomic<uint64_t> samples{0};
+    inline static std::atomic<uint64_t> dropped{0};
+    inline static std::atomic<uint64_t> sampleNs{0};
+
+    // plain TLS only: this runs inside malloc, possibly before any constructor. A thread's first
+    // allocation draws its interval instead of being sampled, or every thread would add a phantom
+    // sampleBytes to its first call site.
+    static constexpr int64_t UNDRAWN = INT64_MIN;
+    inline static thread_local int64_t untilSample __attribute__((tls_model("initial-exec"))) = UNDRAWN;
+    inline static thread_local uint64_t randomState __attribute__((tls_model("initial-exec"))) = 0;
+    inline static thread_local bool inHook __attribute__((tls_model("initial-exec"))) = false;
+
+    static size_t slotOf(uintptr_t p, size_t slots) {
+        uint64_t h = static_cast<uint64_t>(p) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(h >> 32) & (slots - 1);
+    }
+
+    static int64_t nextInterval() {
+        if (randomState == 0) randomState = reinterpret_cast<uintptr_t>(&randomState) ^ 0x2545F4914F6CDD1DULL;
+        randomState ^= randomState << 13;
+        randomState ^= randomState >> 7;
+        randomState ^= randomState << 17;
+        double uniform = (static_cast<double>(randomState >> 11) + 1.0) / 9007199254740993.0;
+        return static_cast<int64_t>(-std::log(uniform) * static_cast<double>(sampleBytes)) + 1;
+    }
+
+    static uint32_t siteFor(void* const* frames, int depth) {
+        uint64_t h = 1469598103934665603ULL;
+        for (int i = 0; i < depth; i++) h = (h ^ reinterpret_cast<uintptr_t>(frames[i])) * 1099511628211ULL;
+        if (h == 0) h = 1;
+        size_t start = static_cast<size_t>(h) & (SITE_SLOTS - 1);
+        for (size_t i = 0; i < 64; i++) {
+            size_t index = (start + i) & (SITE_SLOTS - 1);
+            Site& site = tables->sites[index];
+            uint64_t seen = site.hash.load(std::memory_order_acquire);
+            if (seen == h) return static_cast<uint32_t>(index);
+            if (seen == 0) {
+                if (site.hash.compare_exchange_strong(seen, h, std::memory_order_acq_rel)) {
+                    site.depth = depth;
+                    std::memcpy(site.frames, frames, sizeof(void*) * depth);
+                    site.ready.store(1, std::memory_order_release);
+                    return static_cast<uint32_t>(index);
+                }
+                if (seen == h) return static_cast<uint32_t>(index);
             }
-            free(symbols);
         }
-        return ss.str();
+        return UINT32_MAX;
     }
-#endif
 
-    void setupSignalHandlers() {
-        std::signal(SIGTERM, signalHandler);
-        std::signal(SIGINT, signalHandler);
-        std::signal(SIGABRT, signalHandler);
-        std::signal(SIGFPE, signalHandler);
-        std::signal(SIGILL, signalHandler);
-        std::signal(SIGSEGV, signalHandler);
+    __attribute__((noinline)) static void sample(void* p, size_t size) {
+        untilSample = nextInterval();
+        if (inHook) return;
+        inHook = true;
+        timespec began, ended;
+        clock_gettime(CLOCK_MONOTONIC, &began);
 
-#ifndef _WIN32
-        std::signal(SIGBUS, signalHandler);
-        std::signal(SIGQUIT, signalHandler);
-        std::signal(SIGTRAP, signalHandler);
-#endif
+        // drop sample(), allocated() and the wrapper, which all keep their frames
+        void* frames[MAX_FRAMES + 3];
+        int count = backtrace(frames, MAX_FRAMES + 3);
+        int depth = count > 3 ? count - 3 : 0;
+        uint32_t siteIndex = siteFor(frames + 3, depth);
+
+        // unbiased estimate of what this one sample stands for
+        double probability = 1.0 - std::exp(-static_cast<double>(size) / static_cast<double>(sampleBytes));
+        int64_t bytes = static_cast<int64_t>(static_cast<double>(size) / probability);
+        int64_t allocations = static_cast<int64_t>(1.0 / probability + 0.5);
+
+        bool stored = false;
+        if (siteIndex != UINT32_MAX) {
+            uintptr_t key = reinterpret_cast<uintptr_t>(p);
+            size_t start = slotOf(key, LIVE_SLOTS);
+            for (size_t i = 0; i < 64 && !stored; i++) {
+                Live& slot = tables->live[(start + i) & (LIVE_SLOTS - 1)];
+                uintptr_t seen = slot.ptr.load(std::memory_order_relaxed);
+                if (seen > 1 || !slot.ptr.compare_exchange_strong(seen, 2, std::memory_order_acquire)) continue;
+                slot.site = siteIndex;
+                slot.bytes = bytes;
+                slot.count = allocations;
+                slot.ptr.store(key, std::memory_order_release);
+                tables->filter[slotOf(key, FILTER_SLOTS)].fetch_add(1, std::memory_order_relaxed);
+                stored = true;
+            }
+            Site& site = tables->sites[siteIndex];
+            site.totalBytes.fetch_add(bytes, std::memory_order_relaxed);
+            site.totalCount.fetch_add(allocations, std::memory_order_relaxed);
+            if (stored) {
+                site.liveBytes.fetch_add(bytes, std::memory_order_relaxed);
+                site.liveCount.fetch_add(allocations, std::memory_order_relaxed);
+            }
+        }
+        (stored ? samples : dropped).fetch_add(1, std::memory_order_relaxed);
+
+        clock_gettime(CLOCK_MONOTONIC, &ended);
+        sampleNs.fetch_add((ended.tv_sec - began.tv_sec) * 1000000000ULL + (ended.tv_nsec - began.tv_nsec),
+                           std::memory_order_relaxed);
+        inHook = false;
     }
 
-    static void signalHandler(int sigNum) {
-        if (globalInstance) {
-            globalInstance->handleSignal(sigNum);
+    __attribute__((noinline)) static void forget(void* p) {
+        uintptr_t key = reinterpret_cast<uintptr_t>(p);
+        size_t start = slotOf(key, LIVE_SLOTS);
+        for (size_t i = 0; i < 64; i++) {
+            Live& slot = tables->live[(start + i) & (LIVE_SLOTS - 1)];
+            uintptr_t seen = slot.ptr.load(std::memory_order_acquire);
+            if (seen == 0) return;
+            if (seen != key) continue;
+            Site& site = tables->sites[slot.site];
+            site.liveBytes.fetch_sub(slot.bytes, std::memory_order_relaxed);
+            site.liveCount.fetch_sub(slot.count, std::memory_order_relaxed);
+            if (slot.ptr.compare_exchange_strong(seen, 1, std::memory_order_release)) {
+                tables->filter[slotOf(key, FILTER_SLOTS)].fetch_sub(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+    }
+
+public:
+    // Set by the COS_HEAP_INTERPOSE wrappers; without them start() has nothing to sample
+    inline static bool interposed = false;
+
+    static inline bool isSampling() { return active.load(std::memory_order_relaxed); }
+    // false until the profiler first runs, then frees may hit sampled blocks
+    static inline bool isTracking() { return tables != nullptr; }
+
+    // Every wrapper reports through here. Out of line, so the wrappers' idle path stays a flag test and
+    // a jump, and so a sampled stack always has the same frames above the caller.
+    __attribute__((noinline)) static void* allocated(void* p, size_t size) {
+        if (!active.load(std::memory_order_relaxed) || !p) return p;
+        if (untilSample == UNDRAWN) untilSample = nextInterval();
+        untilSample -= static_cast<int64_t>(size);
+        if (untilSample <= 0) sample(p, size);
+        return p;
+    }
+
+    static inline void onFree(void* p) {
+        if (!p || !tables) return;
+        if (tables->filter[slotOf(reinterpret_cast<uintptr_t>(p), FILTER_SLOTS)].load(std::memory_order_relaxed) == 0) return;
+        forget(p);
+    }
+
+    static bool start(size_t meanBytes) {
+        if (active.load() || meanBytes == 0) return active.load();
+        if (!tables) {
+            void* mem = mmap(nullptr, sizeof(Tables), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) return false;
+            tables = static_cast<Tables*>(mem);
+        }
+        sampleBytes = meanBytes;
+        void* warmup[1];
+        backtrace(warmup, 1);
+        active = true;
+        return true;
+    }
+
+    // Stops sampling; frees of blocks already sampled keep being accounted
+    static void stop() { active = false; }
+
+    static inline bool isActive() { return active.load(); }
+    static inline size_t getSampleBytes() { return sampleBytes; }
+    static inline uint64_t getSampleCount() { return samples.load(); }
+    static inline uint64_t getDroppedCount() { return dropped.load(); }
+    static inline uint64_t getSampleNs() { return sampleNs.load(); }
+
+    static std::vector<SiteStats> topSites(size_t limit, int64_t& liveTotal) {
+        std::vector<SiteStats> sites;
+        liveTotal = 0;
+        if (!tables) return sites;
+        for (size_t i = 0; i < SITE_SLOTS; i++) {
+            const Site& site = tables->sites[i];
+            if (!site.ready.load(std::memory_order_acquire)) continue;
+            SiteStats stats{site.liveBytes.load(), site.liveCount.load(), site.totalBytes.load(),
+                            site.totalCount.load(), site.depth, {}};
+            std::memcpy(stats.frames, site.frames, sizeof(void*) * site.depth);
+            liveTotal += stats.liveBytes;
+            sites.push_back(stats);
+        }
+        std::sort(sites.begin(), sites.end(), [](const SiteStats& a, const SiteStats& b) {
+            return a.liveBytes != b.liveBytes ? a.liveBytes > b.liveBytes : a.totalBytes > b.totalBytes;
+        });
+        if (sites.size() > limit) sites.resize(limit);
+        return sites;
+    }
+};
+#endif
+
+#ifndef _WIN32
+// Breadcrumbs: small binary records of what the program was doing, kept in a fixed lock-free ring and
+// decoded only when something goes wrong. Recording claims a slot with one atomic increment and fills
+// it in place; a per-slot sequence number lets the crash path skip a slot caught mid-write.
+// Categories are kept by pointer, so they must be string literals.
+class Breadcrumbs {
+public:
+    static constexpr size_t CAPACITY = 1024;
+
+    struct Crumb {
+        const char* category;
+        uint32_t id;
+        pid_t tid;
+        int64_t a;
+        int64_t b;
+        uint64_t ns;
+    };
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        Crumb crumb;
+    };
+
+    inline static Slot ring[CAPACITY];
+    inline static std::atomic<uint64_t> head{0};
+    inline static thread_local pid_t cachedTid __attribute__((tls_model("initial-exec"))) = 0;
+
+    // First record on a thread; a forked child starts over, its one thread has a new tid
+    static pid_t currentTid() {
+        static const bool forkReset = pthread_atfork(nullptr, nullptr, [] { cachedTid = 0; }) == 0;
+        (void)forkReset;
+        return static_cast<pid_t>(syscall(SYS_gettid));
+    }
+
+public:
+    inline static void record(const char* category, uint32_t id, int64_t a, int64_t b) {
+        uint64_t n = head.fetch_add(1, std::memory_order_relaxed);
+        Slot& slot = ring[n & (CAPACITY - 1)];
+        slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+        // the odd seq must be visible to other cores before the crumb, or a reader could take a torn one
+        std::atomic_thread_fence(std::memory_order_release);
+        if (cachedTid == 0) cachedTid = currentTid();
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        slot.crumb = {category, id, cachedTid, a, b, static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec};
+        slot.seq.store(2 * n + 2, std::memory_order_release);
+    }
+
+    inline static uint64_t getCount() { return head.load(); }
+
+    // Newest `limit` complete crumbs, oldest first; no allocation, safe in a signal handler
+    static size_t newest(Crumb* out, size_t limit) {
+        uint64_t end = head.load(std::memory_order_acquire);
+        uint64_t first = end > CAPACITY ? end - CAPACITY : 0;
+        if (end - first > limit) first = end - limit;
+        size_t kept = 0;
+        for (uint64_t n = first; n < end; n++) {
+            const Slot& slot = ring[n & (CAPACITY - 1)];
+            if (slot.seq.load(std::memory_order_acquire) != 2 * n + 2) continue;
+            Crumb crumb = slot.crumb;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) != 2 * n + 2) continue;
+            out[kept++] = crumb;
+        }
+        return kept;
+    }
+};
+#endif
+
+#ifndef _WIN32
+// Crash annotations: live "key = value" state (current document, request, mode) kept in fixed slots
+// and read by the crash path without locks or allocation. A key claims its slot once, by hash and
+// linear probing; after that an update is a seqlock write in place: the sequence goes odd, the value
+// is copied, the sequence goes even. Readers retry a slot that changed underneath them.
+class Annotations {
+public:
+    static constexpr size_t CAPACITY = 64;
+    static constexpr size_t KEY_SIZE = 32;
+    static constexpr size_t VALUE_SIZE = 224;
+    static constexpr int WRITER_SPINS = 1024;
+
+    struct Entry {
+        char key[KEY_SIZE];
+        char value[VALUE_SIZE];
+    };
+
+private:
+    enum : uint32_t { FREE, CLAIMING, READY };
+
+    struct Slot {
+        std::atomic<uint32_t> state;
+        std::atomic<uint32_t> seq;
+        uint32_t length;
+        char key[KEY_SIZE];
+        char value[VALUE_SIZE];
+    };
+
+    inline static Slot slots[CAPACITY];
+
+    static Slot* find(const char* key, bool claim) {
+        size_t keyLength = strnlen(key, KEY_SIZE);
+        if (keyLength == KEY_SIZE) return nullptr;
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < keyLength; i++) hash = (hash ^ static_cast<unsigned char>(key[i])) * 16777619u;
+
+        for (size_t probe = 0; probe < CAPACITY; probe++) {
+            Slot& slot = slots[(hash + probe) & (CAPACITY - 1)];
+            uint32_t state = slot.state.load(std::memory_order_acquire);
+            if (state == FREE) {
+                if (!claim) return nullptr;
+                if (slot.state.compare_exchange_strong(state, CLAIMING, std::memory_order_acquire)) {
+                    std::memcpy(slot.key, key, keyLength);
+                    slot.key[keyLength] = '\0';
+                    slot.state.store(READY, std::memory_order_release);
+                    return &slot;
+                }
+            }
+            // another writer is claiming this slot, it may be for the same key; bounded like the seq
+            // wait in set(), the claimer may be the thread a signal handler interrupted
+            for (int spins = 0; state == CLAIMING; spins++) {
+                if (spins == WRITER_SPINS) return nullptr;
+                state = slot.state.load(std::memory_order_acquire);
+            }
+            if (std::strncmp(slot.key, key, KEY_SIZE - 1) == 0) return &slot;
+        }
+        return nullptr;
+    }
+
+public:
+    // False when dropped: a key of KEY_SIZE bytes or more, all slots holding other keys, or another
+    // writer still claiming the slot or writing the key. Values are cut to VALUE_SIZE - 1 bytes.
+    static bool set(const char* key, const char* value, size_t length) {
+        Slot* slot = find(key, true);
+        if (!slot) return false;
+        if (length > VALUE_SIZE - 1) length = VALUE_SIZE - 1;
+
+        // Writers of the same key take turns on the odd sequence. One that stays odd may be held by a
+        // preempted thread, or by the thread a signal handler interrupted, so the wait is bounded.
+        uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+        for (int spins = 0; ; spins++) {
+            if (spins == WRITER_SPINS) return false;
+            if (seq & 1) {
+                seq = slot->seq.load(std::memory_order_relaxed);
+            } else if (slot->seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire)) {
+                break;
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(slot->value, value, length);
+        slot->value[length] = '\0';
+        slot->length = static_cast<uint32_t>(length);
+        slot->seq.store(seq + 2, std::memory_order_release);
+        return true;
+    }
+
+    static bool clear(const char* key) {
+        return !find(key, false) || set(key, "", 0);
+    }
+
+    // Non-empty annotations; no allocation, safe in a signal handler. A slot still being written after a
+    // few retries (its writer may be the interrupted thread) is skipped.
+    static size_t snapshot(Entry* out, size_t limit) {
+        size_t kept = 0;
+        for (size_t i = 0; i < CAPACITY && kept < limit; i++) {
+            const Slot& slot = slots[i];
+            if (slot.state.load(std::memory_order_acquire) != READY) continue;
+            for (int attempt = 0; attempt < 4; attempt++) {
+                uint32_t before = slot.seq.load(std::memory_order_acquire);
+                if (before & 1) continue;
+                uint32_t length = slot.length;
+                if (length > VALUE_SIZE - 1) continue;
+                std::memcpy(out[kept].value, slot.value, length);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) != before) continue;
+                if (length == 0) break;
+                out[kept].value[length] = '\0';
+                std::memcpy(out[kept].key, slot.key, KEY_SIZE);
+                out[kept].key[KEY_SIZE - 1] = '\0';
+                kept++;
+                break;
+            }
+        }
+        return kept;
+    }
+};
+#endif
+
+#ifndef _WIN32
+// Mutex contention profiler. The COS_MUTEX_INTERPOSE pthread_mutex_lock wrapper tries the lock first and
+// only when that fails takes the caller's stack and times the blocking wait, so an uncontended lock
+// costs a PLT hop and a trylock, ~6 ns per lock+unlock (cos-heap-bench); libcrash only has it with
+// -DTRIG_MUTEX_INTERPOSE=ON. Only pthread_mutex_lock is wrapped: unlock, trylock and timedlock are
+// not, so hold times are not measured and timed waits are not seen. Waits are summed per call-site
+// stack in tables sharded by thread, so one hot site does not bounce its counters between cores;
+// shards are merged when the report is built.
+class LockProfiler {
+public:
+    static constexpr int MAX_FRAMES = 16;
+    static constexpr int SHARDS = 16;
+    static constexpr size_t SITE_SLOTS = 1024;
+
+    using LockFn = int (*)(pthread_mutex_t*);
+
+    struct SiteStats {
+        int64_t waitNs;
+        int64_t maxWaitNs;
+        int64_t contentions;
+        void* mutex;
+        int depth;
+        void* frames[MAX_FRAMES];
+    };
+
+private:
+    struct Site {
+        std::atomic<uint64_t> hash;
+        std::atomic<int> ready;
+        int depth;
+        void* frames[MAX_FRAMES];
+        std::atomic<int64_t> waitNs;
+        std::atomic<int64_t> maxWaitNs;
+        std::atomic<int64_t> contentions;
+        std::atomic<void*> mutex;
+    };
+
+    struct Tables {
+        Site shards[SHARDS][SITE_SLOTS];
+    };
+
+    inline static Tables* tables = nullptr;
+    inline static std::atomic<bool> active{false};
+    inline static std::atomic<LockFn> nextLock{nullptr};
+    inline static std::atomic<uint64_t> contended{0};
+    inline static std::atomic<uint64_t> dropped{0};
+    inline static std::atomic<int64_t> totalWaitNs{0};
+
+    // plain TLS only: this runs inside pthread_mutex_lock, possibly before any constructor
+    inline static thread_local bool inHook __attribute__((tls_model("initial-exec"))) = false;
+    inline static thread_local int shard __attribute__((tls_model("initial-exec"))) = -1;
+
+    static uint64_t stackHash(void* const* frames, int depth) {
+        uint64_t h = 1469598103934665603ULL;
+        for (int i = 0; i < depth; i++) h = (h ^ reinterpret_cast<uintptr_t>(frames[i])) * 1099511628211ULL;
+        return h ? h : 1;
+    }
+
+    static void note(pthread_mutex_t* mutex, void* const* frames, int depth, int64_t waitNs) {
+        if (shard < 0) shard = static_cast<int>(syscall(SYS_gettid)) % SHARDS;
+        Site* sites = tables->shards[shard];
+        uint64_t h = stackHash(frames, depth);
+        size_t start = static_cast<size_t>(h) & (SITE_SLOTS - 1);
+        for (size_t i = 0; i < 64; i++) {
+            Site& site = sites[(start + i) & (SITE_SLOTS - 1)];
+            uint64_t seen = site.hash.load(std::memory_order_acquire);
+            if (seen == 0 && site.hash.compare_exchange_strong(seen, h, std::memory_order_acq_rel)) {
+                site.depth = depth;
+                std::memcpy(site.frames, frames, sizeof(void*) * depth);
+                site.ready.store(1, std::memory_order_release);
+                seen = h;
+            }
+            if (seen != h) continue;
+            site.waitNs.fetch_add(waitNs, std::memory_order_relaxed);
+            site.contentions.fetch_add(1, std::memory_order_relaxed);
+            site.mutex.store(mutex, std::memory_order_relaxed);
+            int64_t max = site.maxWaitNs.load(std::memory_order_relaxed);
+            while (waitNs > max && !site.maxWaitNs.compare_exchange_weak(max, waitNs, std::memory_order_relaxed)) {}
+            return;
+        }
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+public:
+    // Set by the COS_MUTEX_INTERPOSE wrapper; without it start() has nothing to measure
+    inline static bool interposed = false;
+
+    // The wrapper's slow path, after trylock found the mutex taken; caller is the wrapper's return address
+    __attribute__((noinline)) static int lockContended(pthread_mutex_t* mutex, void* caller) {
+        LockFn lock = nextLock.load(std::memory_order_relaxed);
+        if (!lock) {
+            lock = reinterpret_cast<LockFn>(dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+            // glibc's base versions of it (x86_64, i386, aarch64), should the unversioned lookup fail
+            for (const char* version : {"GLIBC_2.2.5", "GLIBC_2.0", "GLIBC_2.17"}) {
+                if (!lock) lock = reinterpret_cast<LockFn>(dlvsym(RTLD_NEXT, "pthread_mutex_lock", version));
+            }
+            if (!lock) {
+                static const char message[] = "COS: pthread_mutex_lock wrapper found no pthread_mutex_lock to call\n";
+                ssize_t written = ::write(STDERR_FILENO, message, sizeof(message) - 1);
+                (void)written;
+                std::abort();
+            }
+            nextLock.store(lock, std::memory_order_relaxed);
+        }
+        if (!active.load(std::memory_order_relaxed) || inHook) return lock(mutex);
+        // the unwinder takes a mutex of its own on first use
+        inHook = true;
+        // start at the lock's caller; the wrapper may have tail-called into here and left no frame
+        void* frames[MAX_FRAMES + 2];
+        int count = backtrace(frames, MAX_FRAMES + 2);
+        int skip = 1;
+        while (skip < count && frames[skip] != caller) skip++;
+        if (skip == count) skip = 1;
+        int depth = count - skip;
+        timespec began, ended;
+        clock_gettime(CLOCK_MONOTONIC, &began);
+        int rc = lock(mutex);
+        clock_gettime(CLOCK_MONOTONIC, &ended);
+        int64_t waitNs = (ended.tv_sec - began.tv_sec) * 1000000000LL + (ended.tv_nsec - began.tv_nsec);
+        contended.fetch_add(1, std::memory_order_relaxed);
+        totalWaitNs.fetch_add(waitNs, std::memory_order_relaxed);
+        note(mutex, frames + skip, depth, waitNs);
+        inHook = false;
+        return rc;
+    }
+
+    static bool start() {
+        if (active.load()) return true;
+        if (!tables) {
+            void* mem = mmap(nullptr, sizeof(Tables), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) return false;
+            tables = static_cast<Tables*>(mem);
+        }
+        void* warmup[1];
+        backtrace(warmup, 1);
+        active = true;
+        return true;
+    }
+
+    static void stop() { active = false; }
+
+    static inline bool isActive() { return active.load(); }
+    static inline uint64_t getContendedCount() { return contended.load(); }
+    static inline uint64_t getDroppedCount() { return dropped.load(); }
+    static inline int64_t getTotalWaitNs() { return totalWaitNs.load(); }
+
+    // Call sites by total time spent waiting, shards merged
+    static std::vector<SiteStats> topSites(size_t limit) {
+        std::vector<SiteStats> sites;
+        if (!tables) return sites;
+        std::map<uint64_t, size_t> byHash;
+        for (int s = 0; s < SHARDS; s++) {
+            for (size_t i = 0; i < SITE_SLOTS; i++) {
+                const Site& site = tables->shards[s][i];
+                if (!site.ready.load(std::memory_order_acquire)) continue;
+                uint64_t h = site.hash.load();
+                auto known = byHash.find(h);
+                if (known == byHash.end()) {
+                    SiteStats stats{0, 0, 0, nullptr, site.depth, {}};
+                    std::memcpy(stats.frames, site.frames, sizeof(void*) * site.depth);
+                    known = byHash.emplace(h, sites.size()).first;
+                    sites.push_back(stats);
+                }
+                SiteStats& stats = sites[known->second];
+                stats.waitNs += site.waitNs.load();
+                stats.maxWaitNs = std::max(stats.maxWaitNs, site.maxWaitNs.load());
+                stats.contentions += site.contentions.load();
+                stats.mutex = site.mutex.load();
+            }
+        }
+        std::sort(sites.begin(), sites.end(), [](const SiteStats& a, const SiteStats& b) {
+            return a.waitNs > b.waitNs;
+        });
+        if (sites.size() > limit) sites.resize(limit);
+        return sites;
+    }
+};
+#endif
+
+#ifndef _WIN32
+// Opt-in CPU sampling profiler. Each thread gets its own CLOCK_THREAD_CPUTIME timer delivering SIGPROF
+// to that thread only, so samples follow CPU time rather than wall time. The handler unwinds into a
+// preallocated ring (newest samples win) and nothing else; symbolizing and folding happen at dump time.
+class SamplingProfiler {
+public:
+    static constexpr int MAX_FRAMES = 48;
+    static constexpr int MAX_THREADS = 256;
+
+    struct Sample {
+        std::atomic<unsigned> seq;
+        pid_t tid;
+        int frameCount;
+        void* frames[MAX_FRAMES];
+    };
+
+private:
+    struct ThreadTimer {
+        pid_t tid;
+        timer_t timer;
+    };
+
+    inline static Sample* ring = nullptr;
+    inline static size_t ringSize = 0;
+    inline static std::atomic<unsigned long long> taken{0};
+    inline static std::atomic<long long> handlerNs{0};
+    inline static std::atomic<bool> sampling{false};
+
+    std::mutex lock;
+    std::map<pid_t, std::string> threadNames;
+    ThreadTimer timers[MAX_THREADS];
+    int timerCount;
+    int skippedThreads;
+    int hz;
+    long long startedNs;
+    long long activeNs;
+
+    static long long nowNs(clockid_t clock) {
+        timespec ts;
+        clock_gettime(clock, &ts);
+        return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    static void handler(int, siginfo_t*, void*) {
+        if (!sampling.load(std::memory_order_relaxed)) return;
+        int savedErrno = errno;
+        long long began = nowNs(CLOCK_MONOTONIC);
+        unsigned long long n = taken.fetch_add(1, std::memory_order_relaxed);
+        Sample& sample = ring[n % ringSize];
+        sample.seq.fetch_add(1, std::memory_order_acq_rel);
+        sample.tid = static_cast<pid_t>(syscall(SYS_gettid));
+        // drop the handler and the signal trampoline
+        void* frames[MAX_FRAMES + 2];
+        int count = backtrace(frames, MAX_FRAMES + 2);
+        sample.frameCount = count > 2 ? count - 2 : 0;
+        std::memcpy(sample.frames, frames + 2, sizeof(void*) * sample.frameCount);
+        sample.seq.fetch_add(1, std::memory_order_release);
+        handlerNs.fetch_add(nowNs(CLOCK_MONOTONIC) - began, std::memory_order_relaxed);
+        errno = savedErrno;
+    }
+
+    // the kernel's MAKE_THREAD_CPUCLOCK(tid, CPUCLOCK_SCHED)
+    static clockid_t encodedClock(pid_t tid) {
+        return static_cast<clockid_t>((~static_cast<unsigned>(tid) << 3) | 6);
+    }
+
+    // pthread_getcpuclockid() wants a pthread_t, which a tid found in /proc/self/task does not come
+    // with; other threads get the same encoding only once it matched what it returns for this one
+    static bool threadClock(pid_t tid, clockid_t* clock) {
+        pid_t self = static_cast<pid_t>(syscall(SYS_gettid));
+        if (tid == self) return pthread_getcpuclockid(pthread_self(), clock) == 0;
+        static const bool encodingHolds = [self]() {
+            clockid_t own;
+            return pthread_getcpuclockid(pthread_self(), &own) == 0 && own == encodedClock(self);
+        }();
+        if (!encodingHolds) return false;
+        *clock = encodedClock(tid);
+        return true;
+    }
+
+    bool armThread(pid_t tid) {
+        if (timerCount == MAX_THREADS) {
+            skippedThreads++;
+            return false;
+        }
+        sigevent event{};
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = SIGPROF;
+        event.sigev_notify_thread_id = tid;
+        clockid_t clock;
+        if (!threadClock(tid, &clock)) return false;
+        timer_t timer;
+        if (timer_create(clock, &event, &timer) != 0) return false;
+        long period = 1000000000L / hz;
+        itimerspec spec{{period / 1000000000L, period % 1000000000L}, {period / 1000000000L, period % 1000000000L}};
+        timer_settime(timer, 0, &spec, nullptr);
+        timers[timerCount++] = {tid, timer};
+
+        // named now, the thread may be long gone when the profile is written
+        std::string comm;
+        std::ifstream commFile("/proc/self/task/" + std::to_string(tid) + "/comm");
+        std::getline(commFile, comm);
+        std::replace(comm.begin(), comm.end(), ' ', '_');
+        threadNames[tid] = comm.empty() ? "thread-" + std::to_string(tid) : comm;
+        return true;
+    }
+
+    static std::string frameName(void* address) {
+        Dl_info info{};
+        if (dladdr(address, &info) && info.dli_sname) {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            std::string name = (status == 0 && demangled) ? demangled : info.dli_sname;
+            free(demangled);
+            // folded format: ';' separates frames and ' ' starts the count
+            std::replace(name.begin(), name.end(), ';', ':');
+            std::replace(name.begin(), name.end(), ' ', '_');
+            return name;
+        }
+        std::ostringstream oss;
+        const char* module = info.dli_fname ? std::strrchr(info.dli_fname, '/') : nullptr;
+        oss << (module ? module + 1 : "?") << "+0x" << std::hex
+            << (reinterpret_cast<uintptr_t>(address) - reinterpret_cast<uintptr_t>(info.dli_fbase));
+        return oss.str();
+    }
+
+public:
+    SamplingProfiler() : timerCount(0), skippedThreads(0), hz(0), startedNs(0), activeNs(0) {}
+
+    ~SamplingProfiler() { stop(); }
+
+    bool start(int samplesPerSecond, size_t capacity) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (sampling.load() || samplesPerSecond <= 0 || capacity == 0) return false;
+        if (!ring) {
+            void* mem = mmap(nullptr, capacity * sizeof(Sample), PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) return false;
+            ring = static_cast<Sample*>(mem);
+            ringSize = capacity;
+        }
+        hz = samplesPerSecond;
+
+        void* warmup[1];
+        backtrace(warmup, 1);
+        struct sigaction sa{};
+        sa.sa_sigaction = handler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGPROF, &sa, nullptr);
+
+        sampling = true;
+        startedNs = nowNs(CLOCK_MONOTONIC);
+        rescanLocked();
+        return true;
+    }
+
+    // Arms timers for threads started since the last scan and drops those of finished ones
+    void rescan() {
+        std::lock_guard<std::mutex> guard(lock);
+        rescanLocked();
+    }
+
+    void rescanLocked() {
+        if (!sampling.load()) return;
+        std::vector<pid_t> live;
+        if (DIR* dir = opendir("/proc/self/task")) {
+            while (dirent* entry = readdir(dir)) {
+                if (entry->d_name[0] >= '0' && entry->d_name[0] <= '9') live.push_back(std::atoi(entry->d_name));
+            }
+            closedir(dir);
+        }
+        for (int i = 0; i < timerCount; ) {
+            if (std::find(live.begin(), live.end(), timers[i].tid) == live.end()) {
+                timer_delete(timers[i].timer);
+                timers[i] = timers[--timerCount];
+            } else {
+                i++;
+            }
+        }
+        skippedThreads = 0;
+        for (pid_t tid : live) {
+            bool armed = false;
+            for (int i = 0; i < timerCount && !armed; i++) armed = timers[i].tid == tid;
+            if (!armed) armThread(tid);
+        }
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!sampling.exchange(false)) return;
+        for (int i = 0; i < timerCount; i++) timer_delete(timers[i].timer);
+        timerCount = 0;
+        activeNs += nowNs(CLOCK_MONOTONIC) - startedNs;
+    }
+
+    inline bool isRunning() const { return sampling.load(); }
+    inline int getRate() const { return hz; }
+    inline unsigned long long getSampleCount() const { return taken.load(); }
+    inline long long getHandlerNs() const { return handlerNs.load(); }
+    inline int getSkippedThreads() const { return skippedThreads; }
+
+    // Profiler cost as a share of one CPU over the time it ran
+    double overheadPercent() const {
+        long long active = activeNs + (sampling.load() ? nowNs(CLOCK_MONOTONIC) - startedNs : 0);
+        return active > 0 ? 100.0 * handlerNs.load() / active : 0.0;
+    }
+
+    // Brendan Gregg's folded format, "thread;outer;...;leaf count" per line, ready for flamegraph.pl
+    size_t writeFolded(const std::string& path) {
+        if (!ring) return 0;
+        std::map<std::string, size_t> stacks;
+        std::map<void*, std::string> names;
+        std::map<pid_t, std::string> threads;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            threads = threadNames;
+        }
+        unsigned long long total = taken.load();
+        unsigned long long first = total > ringSize ? total - ringSize : 0;
+        size_t kept = 0;
+        for (unsigned long long n = first; n < total; n++) {
+            const Sample& slot = ring[n % ringSize];
+            unsigned before = slot.seq.load(std::memory_order_acquire);
+            if (before & 1) continue;
+            pid_t tid = slot.tid;
+            int count = slot.frameCount;
+            void* frames[MAX_FRAMES];
+            std::memcpy(frames, slot.frames, sizeof(void*) * count);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) != before || count <= 0) continue;
+
+            auto thread = threads.find(tid);
+            std::string line = thread != threads.end() ? thread->second : "thread-" + std::to_string(tid);
+            for (int i = count - 1; i >= 0; i--) {
+                auto name = names.find(frames[i]);
+                if (name == names.end()) name = names.emplace(frames[i], frameName(frames[i])).first;
+                line += ";" + name->second;
+            }
+            stacks[line]++;
+            kept++;
+        }
+
+        std::ofstream out(path);
+        if (!out.is_open()) return 0;
+        for (const auto& stack : stacks) out << stack.first << " " << stack.second << "\n";
+        return kept;
+    }
+};
+#endif
+
+#ifndef _WIN32
+// Scoped timing events for a Chrome trace / Perfetto timeline. Each thread appends fixed-size events to
+// its own mmapped ring (newest events win) with no locks or allocation, just a clock read and a few stores.
+// Event names are kept by pointer, so they must be string literals or otherwise outlive the export.
+class TraceRecorder {
+public:
+    static constexpr int MAX_THREADS = 256;
+
+    enum Kind : uint32_t { Begin, End, Counter, Instant };
+
+    struct Event {
+        uint64_t ns;
+        const char* name;
+        int64_t value;
+        uint32_t kind;
+    };
+
+private:
+    enum BufferState : int { Live, Exited, Reclaiming };
+
+    struct Buffer {
+        pid_t tid;
+        char threadName[16];
+        std::atomic<int> state;
+        std::atomic<uint64_t> written;
+        Event* events;
+    };
+
+    // Marks a finished thread's ring as reusable. It stays in the export until all MAX_THREADS
+    // rings are taken and a new thread needs one; late events from this thread are dropped.
+    struct BufferRelease {
+        Buffer* buffer;
+        BufferRelease() : buffer(nullptr) {}
+        ~BufferRelease() {
+            if (!buffer) return;
+            local = nullptr;
+            unbuffered = true;
+            buffer->state.store(Exited, std::memory_order_release);
+        }
+    };
+
+    inline static Buffer buffers[MAX_THREADS];
+    inline static std::atomic<int> bufferCount{0};
+    inline static std::atomic<int> skippedThreads{0};
+    inline static std::atomic<bool> recording{false};
+    inline static size_t capacity = 0;
+    // opened once and never closed: record() may hold a copy of it at any time
+    inline static std::atomic<int> markerFd{-1};
+    inline static std::atomic<bool> markerOn{false};
+    inline static thread_local Buffer* local __attribute__((tls_model("initial-exec"))) = nullptr;
+    inline static thread_local bool unbuffered __attribute__((tls_model("initial-exec"))) = false;
+    inline static thread_local BufferRelease release;
+
+    static uint64_t nowNs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+
+    static Buffer* reclaim() {
+        for (int i = 0; i < MAX_THREADS; i++) {
+            int expected = Exited;
+            if (buffers[i].state.compare_exchange_strong(expected, Reclaiming, std::memory_order_acq_rel)) {
+                return &buffers[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // A fresh ring while there are slots left, then the ring of a thread that has exited
+    __attribute__((noinline)) static Buffer* attach() {
+        if (unbuffered) return nullptr;
+        unbuffered = true;
+        Buffer* buffer = nullptr;
+        if (bufferCount.load() < MAX_THREADS) {
+            void* mem = mmap(nullptr, capacity * sizeof(Event), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) return nullptr;
+            int index = bufferCount.load();
+            while (index < MAX_THREADS && !bufferCount.compare_exchange_weak(index, index + 1)) {}
+            if (index < MAX_THREADS) {
+                buffer = &buffers[index];
+                buffer->events = static_cast<Event*>(mem);
+            } else {
+                munmap(mem, capacity * sizeof(Event));
+            }
+        }
+        if (!buffer && !(buffer = reclaim())) {
+            skippedThreads.fetch_add(1);
+            return nullptr;
+        }
+        buffer->tid = static_cast<pid_t>(syscall(SYS_gettid));
+        pthread_getname_np(pthread_self(), buffer->threadName, sizeof(buffer->threadName));
+        buffer->written.store(0, std::memory_order_release);
+        buffer->state.store(Live, std::memory_order_release);
+        unbuffered = false;
+        local = buffer;
+        release.buffer = buffer;
+        return local;
+    }
+
+    // atrace/systrace text that Perfetto and trace-cmd show as slices on the writing thread
+    __attribute__((noinline)) static void mirror(int fd, Kind kind, const char* name, int64_t value) {
+        char line[256];
+        int pid = static_cast<int>(getpid());
+        int n = 0;
+        if (kind == Begin) n = snprintf(line, sizeof(line), "B|%d|%s\n", pid, name);
+        else if (kind == End) n = snprintf(line, sizeof(line), "E|%d\n", pid);
+        else if (kind == Counter) n = snprintf(line, sizeof(line), "C|%d|%s|%lld\n", pid, name, static_cast<long long>(value));
+        else n = snprintf(line, sizeof(line), "B|%d|%s\nE|%d\n", pid, name, pid);
+        if (n > 0) {
+            ssize_t ignored = write(fd, line, static_cast<size_t>(n) < sizeof(line) ? n : sizeof(line) - 1);
+            (void)ignored;
+        }
+    }
+
+    static void writeEscaped(std::ostream& out, const char* text) {
+        // a ring slot read while it is being rewritten can pair a Begin with an End's null name
+        if (!text) return;
+        for (; *text; text++) {
+            unsigned char c = static_cast<unsigned char>(*text);
+            if (c == '"' || c == '\\') out << '\\' << *text;
+            else if (c < 0x20) out << ' ';
+            else out << *text;
+        }
+    }
+
+public:
+    inline static void record(Kind kind, const char* name, int64_t value = 0) {
+        if (markerOn.load(std::memory_order_relaxed)) {
+            int fd = markerFd.load(std::memory_order_relaxed);
+            if (fd >= 0) mirror(fd, kind, name, value);
+        }
+        if (!recording.load(std::memory_order_relaxed)) return;
+        Buffer* buffer = local;
+        if (!buffer && !(buffer = attach())) return;
+        uint64_t n = buffer->written.load(std::memory_order_relaxed);
+        Event& event = buffer->events[n & (capacity - 1)];
+        event.ns = nowNs();
+        event.name = name;
+        event.value = value;
+        event.kind = kind;
+        buffer->written.store(n + 1, std::memory_order_release);
+    }
+
+    // eventsPerThread is rounded up to a power of two; the first call fixes it for the process
+    static bool start(size_t eventsPerThread) {
+        if (eventsPerThread == 0) return false;
+        if (capacity == 0) {
+            size_t size = 1;
+            while (size < eventsPerThread) size <<= 1;
+            capacity = size;
+        }
+        recording = true;
+        return true;
+    }
+
+    static void stop() { recording = false; }
+
+    // Mirrors every event to ftrace's trace_marker as well, so COS scopes show up inside system-wide
+    // traces (perf, trace-cmd, Perfetto). One write(2) per event: meant for tracing sessions only.
+    // Turning it off leaves the fd open, closing it could turn a write in flight into one to a reused fd.
+    static bool mirrorToTraceMarker(bool on) {
+        if (!on || markerFd.load() >= 0) {
+            markerOn = on && markerFd.load() >= 0;
+            return true;
+        }
+        int fd = open("/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+        if (fd < 0) fd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        // anchors CLOCK_MONOTONIC in whatever clock the ftrace buffer uses
+        char sync[64];
+        int n = snprintf(sync, sizeof(sync), "cos_clock_sync: monotonic_ns=%llu\n",
+                         static_cast<unsigned long long>(nowNs()));
+        ssize_t ignored = write(fd, sync, n);
+        (void)ignored;
+        int expected = -1;
+        if (!markerFd.compare_exchange_strong(expected, fd)) close(fd);
+        markerOn = true;
+        return true;
+    }
+
+    inline static bool isMirroring() { return markerOn.load(); }
+
+    inline static bool isRecording() { return recording.load(); }
+    inline static int getThreadCount() { return bufferCount.load(); }
+    inline static int getSkippedThreads() { return skippedThreads.load(); }
+
+    static uint64_t getEventCount() {
+        uint64_t total = 0;
+        for (int i = 0; i < bufferCount.load(); i++) {
+            total += std::min<uint64_t>(buffers[i].written.load(), capacity);
+        }
+        return total;
+    }
+
+    // Chrome trace event JSON, opens in chrome://tracing and ui.perfetto.dev. Timestamps are absolute
+    // CLOCK_MONOTONIC, the clock of `perf record -k mono` and ftrace's "mono" trace_clock, so the timeline
+    // lines up with system-wide traces; otherData ties it to the session log. Scopes cut off by the ring are
+    // dropped, scopes still open (a crash, a hang) are closed at export time so they stay visible.
+    static size_t writeChromeTrace(const std::string& path, const std::string& logPath, const std::string& startTime) {
+        std::ofstream out(path);
+        if (!out.is_open()) return 0;
+        uint64_t exportNs = nowNs();
+        pid_t pid = getpid();
+        size_t kept = 0;
+        out << std::fixed << std::setprecision(3)
+            << "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"log\":\"";
+        writeEscaped(out, logPath.c_str());
+        out << "\",\"start\":\"";
+        writeEscaped(out, startTime.c_str());
+        out << "\",\"clock\":\"CLOCK_MONOTONIC\"},\"traceEvents\":[\n";
+        out << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << pid << ",\"args\":{\"name\":\"";
+        writeEscaped(out, program_invocation_short_name);
+        out << "\"}}";
+
+        std::vector<const char*> open;
+        for (int i = 0; i < bufferCount.load(); i++) {
+            const Buffer& buffer = buffers[i];
+            if (buffer.state.load(std::memory_order_acquire) == Reclaiming) continue;
+            out << ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid << ",\"tid\":" << buffer.tid
+                << ",\"args\":{\"name\":\"";
+            writeEscaped(out, buffer.threadName[0] ? buffer.threadName : "thread");
+            out << "\"}}";
+
+            uint64_t total = buffer.written.load(std::memory_order_acquire);
+            uint64_t first = total > capacity ? total - capacity : 0;
+            open.clear();
+            uint64_t lastNs = 0;
+            for (uint64_t n = first; n < total; n++) {
+                const Event& event = buffer.events[n & (capacity - 1)];
+                if (event.kind == End) {
+                    if (open.empty()) continue;
+                    open.pop_back();
+                } else if (event.kind == Begin) {
+                    open.push_back(event.name);
+                }
+                lastNs = event.ns;
+                double ts = event.ns / 1000.0;
+                out << ",\n{\"ph\":\"" << "BECi"[event.kind] << "\",\"pid\":" << pid << ",\"tid\":" << buffer.tid
+                    << ",\"ts\":" << ts;
+                if (event.kind != End) {
+                    out << ",\"name\":\"";
+                    writeEscaped(out, event.name);
+                    out << "\"";
+                }
+                if (event.kind == Counter) out << ",\"args\":{\"value\":" << event.value << "}";
+                if (event.kind == Instant) out << ",\"s\":\"t\"";
+                out << "}";
+                kept++;
+            }
+            double closeTs = std::max(lastNs, exportNs) / 1000.0;
+            for (size_t k = open.size(); k > 0; k--) {
+                out << ",\n{\"ph\":\"E\",\"pid\":" << pid << ",\"tid\":" << buffer.tid << ",\"ts\":" << closeTs
+                    << ",\"args\":{\"unfinished\":true}}";
+            }
+        }
+        out << "\n]}\n";
+        return out.good() ? kept : 0;
+    }
+};
+
+// RAII begin/end pair for COS_SCOPE
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) {
+        COS_PROBE1(scope_begin, name);
+        TraceRecorder::record(TraceRecorder::Begin, name);
+    }
+    ~TraceScope() {
+        COS_PROBE0(scope_end);
+        TraceRecorder::record(TraceRecorder::End, nullptr);
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#define COS_TRACE_JOIN2(a, b) a##b
+#define COS_TRACE_JOIN(a, b) COS_TRACE_JOIN2(a, b)
+#define COS_SCOPE(name) TraceScope COS_TRACE_JOIN(cosTraceScope, __LINE__)(name)
+#define COS_TRACE_COUNTER(name, value) \
+    do { int64_t cosTraceValue = (value); COS_PROBE2(counter, name, cosTraceValue); \
+         TraceRecorder::record(TraceRecorder::Counter, name, cosTraceValue); } while (0)
+#define COS_TRACE_INSTANT(name) \
+    do { COS_PROBE1(instant, name); TraceRecorder::record(TraceRecorder::Instant, name); } while (0)
+#else
+#define COS_SCOPE(name) ((void)0)
+#define COS_TRACE_COUNTER(name, value) ((void)0)
+#define COS_TRACE_INSTANT(name) ((void)0)
+#endif
+
+#ifndef _WIN32
+// In-process counters, gauges and latency histograms. Counters and histograms are sharded per thread:
+// each thread updates its own cells with plain relaxed stores and readers merge the shards, so the hot
+// path never contends. Histograms use HDR-style log-linear buckets (16 per power of two, values within
+// 6.25%) over the full int64 range. Names are registered once under a lock and used through handles.
+class Metrics {
+public:
+    static constexpr int MAX_COUNTERS = 256;
+    static constexpr int MAX_GAUGES = 128;
+    static constexpr int MAX_HISTOGRAMS = 64;
+    static constexpr int MAX_SHARDS = 256;
+    static constexpr int SUB_BUCKETS = 16;
+    static constexpr int BUCKETS = (64 - 3) * SUB_BUCKETS;
+
+    enum Kind { CounterKind, GaugeKind, HistogramKind };
+
+    struct Counter {
+        int slot = -1;
+        inline void inc(int64_t by = 1) const {
+            if (slot < 0) return;
+            Shard* owner = Metrics::shard();
+            Metrics::bump(owner, owner->counters[slot], by);
+        }
+    };
+
+    struct Gauge {
+        int slot = -1;
+        inline void set(double value) const {
+            if (slot >= 0) gauges[slot].store(value, std::memory_order_relaxed);
+        }
+        inline void add(double by) const {
+            if (slot < 0) return;
+            double seen = gauges[slot].load(std::memory_order_relaxed);
+            while (!gauges[slot].compare_exchange_weak(seen, seen + by, std::memory_order_relaxed)) {}
+        }
+    };
+
+    struct Histogram {
+        int slot = -1;
+        inline void record(int64_t value) const {
+            if (slot < 0) return;
+            Shard* owner = Metrics::shard();
+            HistogramCells& cells = owner->histograms[slot];
+            if (value < 0) value = 0;
+            Metrics::bump(owner, cells.buckets[bucketOf(static_cast<uint64_t>(value))], 1);
+            Metrics::bump(owner, cells.count, 1);
+            Metrics::bump(owner, cells.sum, value);
+            if (value > cells.max.load(std::memory_order_relaxed)) cells.max.store(value, std::memory_order_relaxed);
+        }
+    };
+
+    struct HistogramSnapshot {
+        int64_t count = 0;
+        int64_t sum = 0;
+        int64_t max = 0;
+        std::vector<int64_t> buckets;
+
+        // Highest value of the bucket holding the q-th sample, so never under-reports
+        int64_t quantile(double q) const {
+            if (count == 0) return 0;
+            int64_t rank = static_cast<int64_t>(std::ceil(q * static_cast<double>(count)));
+            if (rank < 1) rank = 1;
+            int64_t seen = 0;
+            for (int i = 0; i < BUCKETS; i++) {
+                seen += buckets[i];
+                if (seen >= rank) return std::min(bucketHigh(i), max);
+            }
+            return max;
+        }
+    };
+
+private:
+    struct HistogramCells {
+        std::atomic<int64_t> count;
+        std::atomic<int64_t> sum;
+        std::atomic<int64_t> max;
+        std::atomic<int64_t> buckets[BUCKETS];
+    };
+
+    struct Shard {
+        bool shared;
+        std::atomic<int64_t> counters[MAX_COUNTERS];
+        HistogramCells histograms[MAX_HISTOGRAMS];
+    };
+
+    struct Descriptor {
+        std::string name;
+        std::string help;
+        Kind kind;
+        int slot;
+    };
+
+    // Gives a finished thread's shard to the next thread; its totals stay in the merge either way.
+    // Also runs from std::exit() at the end of a crash, so the lock only gets the bounded tries.
+    struct ShardRelease {
+        Shard* shard;
+        ShardRelease() : shard(nullptr) {}
+        ~ShardRelease() {
+            if (!shard) return;
+            std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+            if (acquire(guard, false)) freeShards.push_back(shard);
+        }
+    };
+
+    inline static std::mutex lock;
+    inline static std::mutex rateLock;
+    inline static std::vector<Descriptor> descriptors;
+    inline static std::atomic<size_t> registered{0};
+    inline static std::vector<Shard*> freeShards;
+    inline static Shard* shards[MAX_SHARDS + 1];
+    inline static std::atomic<int> shardCount{0};
+    inline static std::atomic<double> gauges[MAX_GAUGES];
+    inline static int counterSlots = 0;
+    inline static int gaugeSlots = 0;
+    inline static int histogramSlots = 0;
+    inline static int64_t previousCounters[MAX_COUNTERS];
+    inline static std::chrono::steady_clock::time_point previousAt;
+    inline static bool havePrevious = false;
+    inline static thread_local Shard* local = nullptr;
+    inline static thread_local ShardRelease release;
+
+    static Shard* newShard(bool shared) {
+        // calloc: a shard is mostly untouched zero pages
+        Shard* shard = static_cast<Shard*>(std::calloc(1, sizeof(Shard)));
+        if (shard) shard->shared = shared;
+        return shard;
+    }
+
+    __attribute__((noinline)) static Shard* attach() {
+        std::lock_guard<std::mutex> guard(lock);
+        Shard* shard = nullptr;
+        if (!freeShards.empty()) {
+            shard = freeShards.back();
+            freeShards.pop_back();
+        } else if (shardCount.load() < MAX_SHARDS && (shard = newShard(false))) {
+            shards[shardCount.load()] = shard;
+            shardCount.fetch_add(1, std::memory_order_release);
+        }
+        if (shard) {
+            release.shard = shard;
+        } else {
+            // out of shards: everyone else shares the last one with atomic adds
+            if (!shards[MAX_SHARDS]) shards[MAX_SHARDS] = newShard(true);
+            shard = shards[MAX_SHARDS];
+        }
+        local = shard;
+        return shard;
+    }
+
+    inline static Shard* shard() {
+        Shard* shard = local;
+        return shard ? shard : attach();
+    }
+
+    // One writer per shard, so a load and a store; the overflow shard needs the locked add
+    inline static void bump(Shard* owner, std::atomic<int64_t>& cell, int64_t by) {
+        if (owner->shared) cell.fetch_add(by, std::memory_order_relaxed);
+        else cell.store(cell.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    inline static int bucketOf(uint64_t value) {
+        if (value < SUB_BUCKETS) return static_cast<int>(value);
+        int msb = 63 - __builtin_clzll(value);
+        return (msb - 3) * SUB_BUCKETS + static_cast<int>((value >> (msb - 4)) & (SUB_BUCKETS - 1));
+    }
+
+    static int64_t bucketHigh(int bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        int msb = bucket / SUB_BUCKETS + 3;
+        uint64_t low = static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << (msb - 4);
+        uint64_t high = low + (1ULL << (msb - 4)) - 1;
+        return high > static_cast<uint64_t>(INT64_MAX) ? INT64_MAX : static_cast<int64_t>(high);
+    }
+
+    static std::string sanitize(const std::string& name) {
+        std::string clean = name.empty() ? "_" : name;
+        for (char& c : clean) {
+            if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != ':') c = '_';
+        }
+        if (std::isdigit(static_cast<unsigned char>(clean[0]))) clean.insert(clean.begin(), '_');
+        return clean;
+    }
+
+    static bool acquire(std::unique_lock<std::mutex>& guard, bool wait) {
+        if (wait) {
+            guard.lock();
+            return true;
+        }
+        for (int i = 0; i < 100; i++) {
+            if (guard.try_lock()) return true;
+            usleep(100);
+        }
+        return false;
+    }
+
+    static int registerMetric(const std::string& rawName, const std::string& help, Kind kind) {
+        std::string name = sanitize(rawName);
+        std::lock_guard<std::mutex> guard(lock);
+        for (const Descriptor& d : descriptors) {
+            if (d.name == name) return d.kind == kind ? d.slot : -1;
+        }
+        int& used = kind == CounterKind ? counterSlots : kind == GaugeKind ? gaugeSlots : histogramSlots;
+        int limit = kind == CounterKind ? MAX_COUNTERS : kind == GaugeKind ? MAX_GAUGES : MAX_HISTOGRAMS;
+        if (used == limit) return -1;
+        descriptors.push_back({name, help, kind, used});
+        registered.store(descriptors.size(), std::memory_order_relaxed);
+        return used++;
+    }
+
+    static int64_t counterTotal(int slot) {
+        int64_t total = 0;
+        int count = shardCount.load(std::memory_order_acquire);
+        for (int i = 0; i < count; i++) total += shards[i]->counters[slot].load(std::memory_order_relaxed);
+        if (shards[MAX_SHARDS]) total += shards[MAX_SHARDS]->counters[slot].load(std::memory_order_relaxed);
+        return total;
+    }
+
+    static HistogramSnapshot histogramTotal(int slot) {
+        HistogramSnapshot snapshot;
+        snapshot.buckets.assign(BUCKETS, 0);
+        int count = shardCount.load(std::memory_order_acquire);
+        for (int i = 0; i <= MAX_SHARDS; i++) {
+            if (i == count) i = MAX_SHARDS;
+            if (!shards[i]) continue;
+            const HistogramCells& cells = shards[i]->histograms[slot];
+            snapshot.count += cells.count.load(std::memory_order_relaxed);
+            snapshot.sum += cells.sum.load(std::memory_order_relaxed);
+            snapshot.max = std::max(snapshot.max, cells.max.load(std::memory_order_relaxed));
+            for (int b = 0; b < BUCKETS; b++) snapshot.buckets[b] += cells.buckets[b].load(std::memory_order_relaxed);
+        }
+        return snapshot;
+    }
+
+public:
+    static Counter counter(const std::string& name, const std::string& help = "") {
+        return Counter{registerMetric(name, help, CounterKind)};
+    }
+
+    static Gauge gauge(const std::string& name, const std::string& help = "") {
+        return Gauge{registerMetric(name, help, GaugeKind)};
+    }
+
+    static Histogram histogram(const std::string& name, const std::string& help = "") {
+        return Histogram{registerMetric(name, help, HistogramKind)};
+    }
+
+    static size_t size() { return registered.load(std::memory_order_relaxed); }
+
+    static int64_t value(const Counter& counter) { return counter.slot >= 0 ? counterTotal(counter.slot) : 0; }
+    static double value(const Gauge& gauge) { return gauge.slot >= 0 ? gauges[gauge.slot].load() : 0.0; }
+    static HistogramSnapshot snapshot(const Histogram& histogram) {
+        return histogram.slot >= 0 ? histogramTotal(histogram.slot) : HistogramSnapshot{0, 0, 0, std::vector<int64_t>(BUCKETS)};
+    }
+
+    // Prometheus text exposition format. Histograms are exported as summaries (p50/p90/p99/p999) since
+    // the quantiles are computed here; counters carry their rate since the previous call as a comment.
+    // The crash path passes wait=false: a crashed thread may hold either lock, so each gets ~10 ms of
+    // tries, then the text is empty (registry) or goes without rates.
+    static std::string prometheusText(bool wait = true) {
+        std::vector<Descriptor> all;
+        {
+            std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+            if (!acquire(guard, wait)) return "";
+            all = descriptors;
+        }
+        std::unique_lock<std::mutex> guard(rateLock, std::defer_lock);
+        bool withRates = acquire(guard, wait);
+        auto now = std::chrono::steady_clock::now();
+        double interval = withRates && havePrevious ? std::chrono::duration<double>(now - previousAt).count() : 0.0;
+        std::ostringstream out;
+        out << std::setprecision(10);
+        for (const Descriptor& d : all) {
+            if (!d.help.empty()) out << "# HELP " << d.name << " " << d.help << "\n";
+            if (d.kind == CounterKind) {
+                int64_t total = counterTotal(d.slot);
+                out << "# TYPE " << d.name << " counter\n" << d.name << " " << total << "\n";
+                if (interval > 0) {
+                    out << "# rate " << (total - previousCounters[d.slot]) / interval << "/s over the last "
+                        << interval << " s\n";
+                }
+                if (withRates) previousCounters[d.slot] = total;
+            } else if (d.kind == GaugeKind) {
+                out << "# TYPE " << d.name << " gauge\n" << d.name << " " << gauges[d.slot].load() << "\n";
+            } else {
+                HistogramSnapshot h = histogramTotal(d.slot);
+                out << "# TYPE " << d.name << " summary\n";
+                for (double q : {0.5, 0.9, 0.99, 0.999}) {
+                    out << d.name << "{quantile=\"" << q << "\"} " << h.quantile(q) << "\n";
+                }
+                out << d.name << "_sum " << h.sum << "\n" << d.name << "_count " << h.count << "\n"
+                    << "# TYPE " << d.name << "_max gauge\n" << d.name << "_max " << h.max << "\n";
+            }
+        }
+        if (withRates) {
+            previousAt = now;
+            havePrevious = true;
+        }
+        return out.str();
+    }
+
+    // Replaces `path` atomically so a scraper never reads half a file
+    static bool writePrometheus(const std::string& path, const std::string& text) {
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream out(temporary);
+            if (!out.is_open()) return false;
+            out << text;
+            if (!out.good()) return false;
+        }
+        return std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+};
+
+// Records the scope's wall time, in nanoseconds, into a Metrics histogram
+class MetricTimer {
+public:
+    explicit MetricTimer(const Metrics::Histogram& histogram)
+        : histogram(histogram), began(std::chrono::steady_clock::now()) {}
+    ~MetricTimer() {
+        histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - began).count());
+    }
+    MetricTimer(const MetricTimer&) = delete;
+    MetricTimer& operator=(const MetricTimer&) = delete;
+
+private:
+    Metrics::Histogram histogram;
+    std::chrono::steady_clock::time_point began;
+};
+#endif
+
+#ifndef _WIN32
+// Process resource time series: RSS, address space, fds, threads, CPU and the busiest thread, read from
+// pre-opened /proc files into stack buffers (no allocation while sampling). Samples are zigzag-varint
+// deltas against the previous one, packed into fixed blocks that each start with an absolute keyframe,
+// so the oldest block can be recycled without losing the ability to decode the rest.
+class ResourceSampler {
+public:
+    enum Field { TimeMs, CpuTicks, MinorFaults, MajorFaults, Threads, RssPages, VszPages, Fds, BusyTid, BusyTicks, FIELDS };
+
+    struct Sample {
+        int64_t values[FIELDS];
+    };
+
+private:
+    static constexpr int BLOCKS = 64;
+    static constexpr int BLOCK_BYTES = 512;
+    static constexpr int MAX_THREADS = 128;
+
+    struct Block {
+        std::atomic<uint32_t> seq;
+        std::atomic<uint32_t> used;
+        uint8_t bytes[BLOCK_BYTES];
+    };
+
+    struct ThreadStat {
+        pid_t tid;
+        int fd;
+        int64_t ticks;
+        bool seen;
+    };
+
+    Block blocks[BLOCKS];
+    std::atomic<uint64_t> blocksStarted;
+    std::atomic<uint64_t> sampleCount;
+    std::atomic_flag busy = ATOMIC_FLAG_INIT;
+    Sample previous;
+    ThreadStat threads[MAX_THREADS];
+    int threadCount;
+    int statFd;
+    int statmFd;
+    int fdDirFd;
+    int taskDirFd;
+    long pageKb;
+    long ticksPerSecond;
+    long long startNs;
+
+    static long long nowNs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    static ssize_t readAt(int fd, char* buffer, size_t size) {
+        if (fd < 0) return -1;
+        ssize_t n = pread(fd, buffer, size - 1, 0);
+        buffer[n > 0 ? n : 0] = '\0';
+        return n;
+    }
+
+    // Fields of a /proc stat line, 1-based as in proc(5); the comm field may hold spaces and parens
+    static void statFields(const char* text, int64_t* out, const int* wanted, int count) {
+        const char* p = std::strrchr(text, ')');
+        if (!p) return;
+        p++;
+        int field = 2;
+        for (int i = 0; i < count; i++) out[i] = 0;
+        while (*p) {
+            while (*p == ' ') p++;
+            if (!*p) break;
+            field++;
+            int64_t value = 0;
+            const char* start = p;
+            while (*p && *p != ' ') value = value * 10 + (*p++ - '0');
+            for (int i = 0; i < count; i++) {
+                if (wanted[i] == field && *start >= '0' && *start <= '9') out[i] = value;
+            }
+        }
+    }
+
+    // Entries of an open /proc directory, "." and ".." excluded
+    template <typename Visit>
+    static int listDirectory(int fd, Visit visit) {
+        if (fd < 0) return -1;
+        lseek(fd, 0, SEEK_SET);
+        alignas(8) char buffer[4096];
+        int count = 0;
+        long n;
+        while ((n = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0) {
+            for (long offset = 0; offset < n; ) {
+                const char* name = buffer + offset + 19;
+                unsigned short length;
+                std::memcpy(&length, buffer + offset + 16, sizeof(length));
+                offset += length;
+                if (name[0] == '.') continue;
+                count++;
+                visit(name);
+            }
+        }
+        return count;
+    }
+
+    void sampleThreads(int64_t& busyTid, int64_t& busyTicks) {
+        for (int i = 0; i < threadCount; i++) threads[i].seen = false;
+        listDirectory(taskDirFd, [&](const char* name) {
+            pid_t tid = static_cast<pid_t>(std::atoi(name));
+            int index = 0;
+            while (index < threadCount && threads[index].tid != tid) index++;
+            if (index == threadCount) {
+                if (threadCount == MAX_THREADS) return;
+                char path[64];
+                snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+                int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+                if (fd < 0) return;
+                threads[threadCount++] = {tid, fd, -1, false};
+            }
+            threads[index].seen = true;
+        });
+
+        busyTid = 0;
+        busyTicks = 0;
+        static const int wanted[] = {14, 15};
+        for (int i = 0; i < threadCount; ) {
+            ThreadStat& thread = threads[i];
+            char text[1024];
+            int64_t cpu[2];
+            if (!thread.seen || readAt(thread.fd, text, sizeof(text)) <= 0) {
+                ::close(thread.fd);
+                thread = threads[--threadCount];
+                continue;
+            }
+            statFields(text, cpu, wanted, 2);
+            int64_t ticks = cpu[0] + cpu[1];
+            int64_t delta = thread.ticks < 0 ? 0 : ticks - thread.ticks;
+            thread.ticks = ticks;
+            if (delta > busyTicks) {
+                busyTicks = delta;
+                busyTid = thread.tid;
+            }
+            i++;
+        }
+    }
+
+    static int putVarint(uint8_t* out, int64_t value) {
+        uint64_t zigzag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+        int n = 0;
+        do {
+            uint8_t byte = zigzag & 0x7F;
+            zigzag >>= 7;
+            out[n++] = byte | (zigzag ? 0x80 : 0);
+        } while (zigzag);
+        return n;
+    }
+
+    static int getVarint(const uint8_t* in, int size, int64_t& value) {
+        uint64_t zigzag = 0;
+        int n = 0;
+        for (int shift = 0; n < size && shift < 64; shift += 7) {
+            uint8_t byte = in[n++];
+            zigzag |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                value = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+                return n;
+            }
+        }
+        return -1;
+    }
+
+    void append(const Sample& sample) {
+        uint8_t encoded[FIELDS * 10];
+        uint64_t started = blocksStarted.load(std::memory_order_relaxed);
+        Block* block = started ? &blocks[(started - 1) % BLOCKS] : nullptr;
+        int length = 0;
+        for (int f = 0; f < FIELDS; f++) length += putVarint(encoded + length, sample.values[f] - previous.values[f]);
+
+        if (!block || block->used.load(std::memory_order_relaxed) + length > BLOCK_BYTES) {
+            block = &blocks[started % BLOCKS];
+            block->seq.fetch_add(1, std::memory_order_acq_rel);
+            block->used.store(0, std::memory_order_relaxed);
+            length = 0;
+            for (int f = 0; f < FIELDS; f++) length += putVarint(encoded + length, sample.values[f]);
+            std::memcpy(block->bytes, encoded, length);
+            block->used.store(length, std::memory_order_release);
+            block->seq.fetch_add(1, std::memory_order_release);
+            blocksStarted.store(started + 1, std::memory_order_release);
+        } else {
+            uint32_t used = block->used.load(std::memory_order_relaxed);
+            std::memcpy(block->bytes + used, encoded, length);
+            block->used.store(used + length, std::memory_order_release);
+        }
+        previous = sample;
+        sampleCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+public:
+    ResourceSampler()
+        : blocksStarted(0), sampleCount(0), previous{}, threadCount(0), statFd(-1), statmFd(-1), fdDirFd(-1),
+          taskDirFd(-1), pageKb(4), ticksPerSecond(100), startNs(0) {
+        for (Block& block : blocks) {
+            block.seq.store(0);
+            block.used.store(0);
+        }
+    }
+
+    ~ResourceSampler() { close(); }
+
+    bool open() {
+        if (statFd >= 0) return true;
+        statFd = ::open("/proc/self/stat", O_RDONLY | O_CLOEXEC);
+        statmFd = ::open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+        fdDirFd = ::open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        taskDirFd = ::open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        pageKb = sysconf(_SC_PAGESIZE) / 1024;
+        ticksPerSecond = sysconf(_SC_CLK_TCK);
+        startNs = nowNs();
+        return statFd >= 0;
+    }
+
+    void close() {
+        for (int fd : {statFd, statmFd, fdDirFd, taskDirFd}) {
+            if (fd >= 0) ::close(fd);
+        }
+        for (int i = 0; i < threadCount; i++) ::close(threads[i].fd);
+        statFd = statmFd = fdDirFd = taskDirFd = -1;
+        threadCount = 0;
+    }
+
+    // Safe from any thread, the crash handler included; a sample already in progress wins
+    bool sample() {
+        if (statFd < 0 || busy.test_and_set(std::memory_order_acquire)) return false;
+        Sample sample{};
+        char text[1024];
+        int64_t* v = sample.values;
+        v[TimeMs] = (nowNs() - startNs) / 1000000;
+        if (readAt(statFd, text, sizeof(text)) > 0) {
+            static const int wanted[] = {14, 15, 10, 12, 20};
+            int64_t stat[5];
+            statFields(text, stat, wanted, 5);
+            v[CpuTicks] = stat[0] + stat[1];
+            v[MinorFaults] = stat[2];
+            v[MajorFaults] = stat[3];
+            v[Threads] = stat[4];
+        }
+        if (readAt(statmFd, text, sizeof(text)) > 0) {
+            long long size = 0, resident = 0;
+            sscanf(text, "%lld %lld", &size, &resident);
+            v[VszPages] = size;
+            v[RssPages] = resident;
+        }
+        // the listing includes the sampler's own fds: its four /proc handles and one per sampled thread
+        int fds = listDirectory(fdDirFd, [](const char*) {});
+        int own = threadCount;
+        for (int fd : {statFd, statmFd, fdDirFd, taskDirFd}) own += fd >= 0;
+        v[Fds] = fds > own ? fds - own : 0;
+        sampleThreads(v[BusyTid], v[BusyTicks]);
+        append(sample);
+        busy.clear(std::memory_order_release);
+        return true;
+    }
+
+    inline uint64_t getSampleCount() const { return sampleCount.load(); }
+    inline size_t getCapacityBytes() const { return sizeof(blocks); }
+
+    // Decodes the ring, oldest first; at most `limit` of the newest samples
+    std::vector<Sample> samples(size_t limit = SIZE_MAX) const {
+        std::vector<Sample> out;
+        uint64_t started = blocksStarted.load(std::memory_order_acquire);
+        uint64_t first = started > BLOCKS ? started - BLOCKS : 0;
+        for (uint64_t n = first; n < started; n++) {
+            const Block& block = blocks[n % BLOCKS];
+            uint32_t seq = block.seq.load(std::memory_order_acquire);
+            if (seq & 1) continue;
+            int used = static_cast<int>(block.used.load(std::memory_order_acquire));
+            size_t mark = out.size();
+            Sample current{};
+            for (int offset = 0; offset < used; ) {
+                Sample next = current;
+                for (int f = 0; f < FIELDS && offset >= 0; f++) {
+                    int64_t delta = 0;
+                    int got = getVarint(block.bytes + offset, used - offset, delta);
+                    offset = got < 0 ? -1 : offset + got;
+                    next.values[f] += delta;
+                }
+                if (offset < 0) break;
+                out.push_back(next);
+                current = next;
+            }
+            if (block.seq.load(std::memory_order_acquire) != seq) out.resize(mark);
+        }
+        if (out.size() > limit) out.erase(out.begin(), out.end() - limit);
+        return out;
+    }
+
+    // Time series table: session time, memory, fds, threads, CPU over the interval and the busiest thread
+    std::string format(size_t limit = SIZE_MAX) const {
+        std::vector<Sample> series = samples(limit);
+        std::ostringstream out;
+        char line[160];
+        snprintf(line, sizeof(line), "%10s %10s %10s %6s %5s %6s %8s %6s  %s\n",
+                 "time", "rss_kib", "vsz_kib", "fds", "thr", "cpu%", "minflt", "majflt", "busiest");
+        out << line;
+        for (size_t i = 0; i < series.size(); i++) {
+            const int64_t* v = series[i].values;
+            const int64_t* before = i > 0 ? series[i - 1].values : nullptr;
+            double cpu = 0.0;
+            long long minor = 0, major = 0;
+            if (before && v[TimeMs] > before[TimeMs]) {
+                double seconds = (v[TimeMs] - before[TimeMs]) / 1000.0;
+                cpu = 100.0 * (v[CpuTicks] - before[CpuTicks]) / ticksPerSecond / seconds;
+                minor = v[MinorFaults] - before[MinorFaults];
+                major = v[MajorFaults] - before[MajorFaults];
+            }
+            char time[16], busiest[32] = "-";
+            snprintf(time, sizeof(time), "%lld:%02lld.%01lld", static_cast<long long>(v[TimeMs] / 60000),
+                     static_cast<long long>(v[TimeMs] / 1000 % 60), static_cast<long long>(v[TimeMs] / 100 % 10));
+            if (v[BusyTicks] > 0) {
+                snprintf(busiest, sizeof(busiest), "%lld (%lld ticks)", static_cast<long long>(v[BusyTid]),
+                         static_cast<long long>(v[BusyTicks]));
+            }
+            snprintf(line, sizeof(line), "%10s %10lld %10lld %6lld %5lld %6.1f %8lld %6lld  %s\n", time,
+                     static_cast<long long>(v[RssPages] * pageKb), static_cast<long long>(v[VszPages] * pageKb),
+                     static_cast<long long>(v[Fds]), static_cast<long long>(v[Threads]), cpu, minor, major, busiest);
+            out << line;
+        }
+        return out.str();
+    }
+};
+#endif
+
+#ifndef _WIN32
+// Carries application state blobs across Tri_reset(): blobs are written into a memfd as they are
+// registered, the memfd is sealed read-only and inherited by the new instance, which maps it once
+// and hands out pointers straight into the mapping (no copy, no reload). Nothing is re-read at the
+// crash: the new instance sees each blob as of its last put().
+class StateHandoff {
+public:
+    static constexpr const char* FD_ENV = "COS_HANDOFF_FD";
+    static constexpr int MAX_ENTRIES = 64;
+
+    struct Entry {
+        char name[56];
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct Table {
+        char magic[8];
+        uint32_t count;
+        uint32_t reserved;
+        Entry entries[MAX_ENTRIES];
+    };
+
+private:
+    int fd;
+    Table table;
+    uint64_t end;
+    bool sealed;
+
+    const char* mapping;
+    size_t mappingSize;
+    const Table* received;
+
+    static uint64_t pageAlign(uint64_t value) {
+        uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        return (value + page - 1) / page * page;
+    }
+
+    static bool writeAll(int fd, const void* data, size_t size, uint64_t offset) {
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t n = pwrite(fd, p, size, static_cast<off_t>(offset));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            size -= static_cast<size_t>(n);
+            offset += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+
+public:
+    StateHandoff() : fd(-1), table{}, end(0), sealed(false), mapping(nullptr), mappingSize(0), received(nullptr) {}
+
+    ~StateHandoff() {
+        release();
+        if (fd >= 0) close(fd);
+    }
+
+    // Sender side. Replaces an entry of the same name; the data is copied into the memfd right away
+    bool put(const std::string& name, const void* data, size_t size) {
+        if (sealed || name.empty() || name.size() >= sizeof(Entry::name)) return false;
+        if (fd < 0) {
+            int raw = memfd_create("cos-state-handoff", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+            if (raw < 0) return false;
+            // keep it clear of the low descriptors the restart dup2()s onto
+            fd = fcntl(raw, F_DUPFD_CLOEXEC, 10);
+            close(raw);
+            if (fd < 0) return false;
+            std::memcpy(table.magic, "COSHAND\0", 8);
+            end = pageAlign(sizeof(Table));
+        }
+
+        uint32_t index = 0;
+        while (index < table.count && std::strcmp(table.entries[index].name, name.c_str()) != 0) index++;
+        if (index == MAX_ENTRIES) return false;
+
+        // a blob starts on a page and owns every page up to the next one, refresh it there if it still
+        // fits; a larger one moves to the end and its old pages stay unused until the restart
+        Entry& entry = table.entries[index];
+        bool inPlace = index < table.count && entry.offset != 0 && pageAlign(entry.offset + size) <=
+                       pageAlign(entry.offset + (entry.size > 0 ? entry.size : 1));
+        uint64_t offset = inPlace ? entry.offset : end;
+        uint64_t extent = pageAlign(offset + (size > 0 ? size : 1));
+        if ((!inPlace && ftruncate(fd, static_cast<off_t>(extent)) != 0) ||
+            (size > 0 && !writeAll(fd, data, size, offset))) {
+            return false;
+        }
+        std::memset(entry.name, 0, sizeof(entry.name));
+        std::memcpy(entry.name, name.data(), name.size());
+        entry.offset = offset;
+        entry.size = size;
+        if (index == table.count) table.count++;
+        if (!inPlace) end = extent;
+        return writeAll(fd, &table, sizeof(table), 0);
+    }
+
+    // Freezes the contents for good and returns the descriptor to pass on, -1 if nothing was put
+    int seal() {
+        if (fd < 0) return -1;
+        if (!sealed) {
+            fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+            sealed = true;
+        }
+        return fd;
+    }
+
+    // Receiver side: adopt the memfd named by COS_HANDOFF_FD, only if it really is sealed
+    bool adopt() {
+        const char* env = std::getenv(FD_ENV);
+        if (!env) return false;
+        // anything but a plain number above stderr is not ours, and must not cost the app stdin/out/err
+        char* end = nullptr;
+        errno = 0;
+        long parsed = std::strtol(env, &end, 10);
+        bool valid = end != env && *end == '\0' && errno == 0 && parsed > STDERR_FILENO && parsed <= INT_MAX;
+        unsetenv(FD_ENV);
+        if (!valid) return false;
+        int inherited = static_cast<int>(parsed);
+        fcntl(inherited, F_SETFD, FD_CLOEXEC);
+
+        struct stat st;
+        int seals = fcntl(inherited, F_GET_SEALS);
+        if (seals < 0 || !(seals & F_SEAL_WRITE) || fstat(inherited, &st) != 0 ||
+            st.st_size < static_cast<off_t>(sizeof(Table))) {
+            close(inherited);
+            return false;
+        }
+        void* mem = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, inherited, 0);
+        close(inherited);
+        if (mem == MAP_FAILED) return false;
+
+        mapping = static_cast<const char*>(mem);
+        mappingSize = static_cast<size_t>(st.st_size);
+        received = reinterpret_cast<const Table*>(mapping);
+        if (std::memcmp(received->magic, "COSHAND\0", 8) != 0 || received->count > MAX_ENTRIES) {
+            release();
+            return false;
+        }
+        return true;
+    }
+
+    const void* get(const std::string& name, size_t* size) const {
+        if (!received) return nullptr;
+        for (uint32_t i = 0; i < received->count; i++) {
+            const Entry& entry = received->entries[i];
+            if (std::strncmp(entry.name, name.c_str(), sizeof(entry.name)) != 0) continue;
+            if (entry.offset + entry.size > mappingSize) return nullptr;
+            if (size) *size = static_cast<size_t>(entry.size);
+            return mapping + entry.offset;
+        }
+        return nullptr;
+    }
+
+    std::vector<std::string> names() const {
+        std::vector<std::string> list;
+        for (uint32_t i = 0; received && i < received->count; i++) {
+            list.emplace_back(received->entries[i].name, strnlen(received->entries[i].name, sizeof(Entry::name)));
+        }
+        return list;
+    }
+
+    void release() {
+        if (mapping) munmap(const_cast<char*>(mapping), mappingSize);
+        mapping = nullptr;
+        mappingSize = 0;
+        received = nullptr;
+    }
+};
+#endif
+
+#ifndef _WIN32
+// The build defines the real install location (TrigConfig.cmake passes it on to apps)
+#ifndef COS_REPORTER_PATH
+#define COS_REPORTER_PATH "/usr/libexec/trigonometry/cosec-reporter"
+#endif
+
+// Hands a finished crash record to an out-of-process reporter (cosec-reporter) through a memfd,
+// so the crashed process can die right away instead of running Qt from inside a signal handler.
+// Everything that does not change during the session is filled in at startup.
+class CrashReportChannel {
+public:
+    static constexpr size_t REGION_SIZE = 1024 * 1024;
+    static constexpr int REPORTER_FD = 3;
+    // CLOCK_MONOTONIC ns of the restart click, read back by the new instance to time the restart
+    static constexpr const char* RESTART_ENV = "COS_RESTART_REQUESTED_NS";
+
+    struct Record {
+        char magic[8];
+        uint32_t version;
+        int32_t pid;
+        int32_t signalNumber;
+        int32_t signalCode;
+        uint64_t faultAddress;
+        uint64_t programCounter;
+        uint64_t stackPointer;
+        int64_t sessionDurationMs;
+        int64_t crashMonotonicNs;
+        uint32_t registerCount;
+        uint64_t registers[64];
+        char registerNames[64][8];
+        char signalName[32];
+        char signalCodeName[32];
+        char faultDescription[96];
+        char timestamp[32];
+        char startTime[32];
+        char executableName[256];
+        char executablePath[PATH_MAX];
+        char workingDirectory[PATH_MAX];
+        char logPath[PATH_MAX];
+        char snapshotPath[PATH_MAX];
+        char windowTitle[256];
+        char iconName[128];
+        uint32_t argumentsSize;
+        char arguments[8192];
+        uint32_t stackTraceSize;
+        uint32_t threadStacksSize;
+        uint32_t logTailSize;
+        char exceptionType[256];
+        char exceptionWhat[512];
+        uint32_t throwSiteSize;
+        uint32_t metricsSize;
+        uint32_t resourceTrendSize;
+        uint32_t lockContentionSize;
+        uint32_t breadcrumbCount;
+        struct {
+            char category[32];
+            uint32_t id;
+            int32_t tid;
+            int64_t a;
+            int64_t b;
+            int64_t agoUs;
+        } breadcrumbs[64];
+        uint32_t annotationCount;
+        struct {
+            char key[32];
+            char value[224];
+        } annotations[64];
+        // stack trace, throw site, thread stacks, metrics, resource trend, lock contention and log tail
+        // follow back to back
+    };
+
+private:
+    int fd;
+    Record* record;
+
+    static void copyField(char* dst, size_t size, const std::string& src) {
+        size_t n = src.size() < size - 1 ? src.size() : size - 1;
+        std::memcpy(dst, src.data(), n);
+        dst[n] = '\0';
+    }
+
+public:
+    CrashReportChannel() : fd(-1), record(nullptr) {}
+
+    ~CrashReportChannel() {
+        if (record) munmap(record, REGION_SIZE);
+        if (fd >= 0) close(fd);
+    }
+
+    bool open(const std::string& executableName, const std::string& startTime,
+              const std::string& logPath, const std::string& snapshotPath) {
+        if (record) return true;
+        fd = memfd_create("cos-crash-report", MFD_CLOEXEC);
+        if (fd < 0 || ftruncate(fd, REGION_SIZE) != 0) return false;
+        void* mem = mmap(nullptr, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED) return false;
+        record = static_cast<Record*>(mem);
+
+        std::memcpy(record->magic, "COSREP1\0", 8);
+        record->version = 7;
+        record->pid = getpid();
+        copyField(record->executableName, sizeof(record->executableName), executableName);
+        copyField(record->startTime, sizeof(record->startTime), startTime);
+        copyField(record->logPath, sizeof(record->logPath), logPath);
+        copyField(record->snapshotPath, sizeof(record->snapshotPath), snapshotPath);
+
+        ssize_t n = readlink("/proc/self/exe", record->executablePath, sizeof(record->executablePath) - 1);
+        record->executablePath[n > 0 ? n : 0] = '\0';
+        if (!getcwd(record->workingDirectory, sizeof(record->workingDirectory))) record->workingDirectory[0] = '\0';
+
+        // argv as the kernel saw it, NUL separated
+        int cmdline = ::open("/proc/self/cmdline", O_RDONLY | O_CLOEXEC);
+        if (cmdline >= 0) {
+            ssize_t got = read(cmdline, record->arguments, sizeof(record->arguments));
+            record->argumentsSize = got > 0 ? static_cast<uint32_t>(got) : 0;
+            close(cmdline);
+        }
+        return true;
+    }
+
+    inline bool isOpen() const { return record != nullptr; }
+
+    void setWindow(const std::string& title, const std::string& iconName) {
+        if (!record) return;
+        copyField(record->windowTitle, sizeof(record->windowTitle), title);
+        copyField(record->iconName, sizeof(record->iconName), iconName);
+    }
+
+    void publish(const CrashInfo& info, const std::string& logContent) {
+        if (!record) return;
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        record->crashMonotonicNs = static_cast<int64_t>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+        record->signalNumber = info.signalNumber;
+        record->signalCode = info.signalCode;
+        record->faultAddress = info.faultAddress;
+        record->programCounter = info.programCounter;
+        record->stackPointer = info.stackPointer;
+        record->sessionDurationMs = info.sessionDurationMs;
+        record->registerCount = static_cast<uint32_t>(info.registers.size() < 64 ? info.registers.size() : 64);
+        for (uint32_t i = 0; i < record->registerCount; i++) {
+            copyField(record->registerNames[i], sizeof(record->registerNames[i]), info.registers[i].first);
+            record->registers[i] = info.registers[i].second;
+        }
+        copyField(record->signalName, sizeof(record->signalName), info.signalName);
+        copyField(record->signalCodeName, sizeof(record->signalCodeName), info.signalCodeName);
+        copyField(record->faultDescription, sizeof(record->faultDescription), info.faultDescription);
+        copyField(record->timestamp, sizeof(record->timestamp), info.timestamp);
+        copyField(record->snapshotPath, sizeof(record->snapshotPath), info.snapshotPath);
+        copyField(record->exceptionType, sizeof(record->exceptionType), info.exceptionType);
+        copyField(record->exceptionWhat, sizeof(record->exceptionWhat), info.exceptionWhat);
+        record->breadcrumbCount = static_cast<uint32_t>(info.breadcrumbs.size() < 64 ? info.breadcrumbs.size() : 64);
+        for (uint32_t i = 0; i < record->breadcrumbCount; i++) {
+            const CrashInfo::Breadcrumb& crumb = info.breadcrumbs[info.breadcrumbs.size() - record->breadcrumbCount + i];
+            copyField(record->breadcrumbs[i].category, sizeof(record->breadcrumbs[i].category), crumb.category);
+            record->breadcrumbs[i].id = crumb.id;
+            record->breadcrumbs[i].tid = crumb.tid;
+            record->breadcrumbs[i].a = crumb.a;
+            record->breadcrumbs[i].b = crumb.b;
+            record->breadcrumbs[i].agoUs = crumb.agoUs;
+        }
+        record->annotationCount = static_cast<uint32_t>(info.annotations.size() < 64 ? info.annotations.size() : 64);
+        for (uint32_t i = 0; i < record->annotationCount; i++) {
+            copyField(record->annotations[i].key, sizeof(record->annotations[i].key), info.annotations[i].first);
+            copyField(record->annotations[i].value, sizeof(record->annotations[i].value), info.annotations[i].second);
+        }
+
+        char* area = reinterpret_cast<char*>(record + 1);
+        size_t room = REGION_SIZE - sizeof(Record);
+        auto place = [&](const std::string& text, uint32_t& size, bool keepTail) {
+            size_t n = text.size() < room ? text.size() : room;
+            std::memcpy(area, text.data() + (keepTail ? text.size() - n : 0), n);
+            size = static_cast<uint32_t>(n);
+            area += n;
+            room -= n;
+        };
+        place(info.stackTrace, record->stackTraceSize, false);
+        place(info.throwSiteTrace, record->throwSiteSize, false);
+        place(info.threadStacks, record->threadStacksSize, false);
+        place(info.metrics, record->metricsSize, false);
+        place(info.resourceTrend, record->resourceTrendSize, false);
+        place(info.lockContention, record->lockContentionSize, false);
+        place(logContent, record->logTailSize, true);
+    }
+
+    // Starts the reporter with the region as fd 3; the caller is free to exit as soon as this returns.
+    // A sealed state handoff rides along as fd 4 so the reporter's relaunch passes it on.
+    bool spawn(const std::string& reporterPath, int handoffFd = -1) const {
+        if (!record || access(reporterPath.c_str(), X_OK) != 0) return false;
+        posix_spawn_file_actions_t actions;
+        posix_spawnattr_t attr;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, fd, REPORTER_FD);
+        if (handoffFd >= 0) {
+            posix_spawn_file_actions_adddup2(&actions, handoffFd, REPORTER_FD + 1);
+            setenv(StateHandoff::FD_ENV, std::to_string(REPORTER_FD + 1).c_str(), 1);
+        }
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+        sigset_t all, none;
+        sigfillset(&all);
+        sigemptyset(&none);
+        posix_spawnattr_setsigdefault(&attr, &all);
+        posix_spawnattr_setsigmask(&attr, &none);
+
+        char fdArg[] = "3";
+        char* argv[] = {const_cast<char*>(reporterPath.c_str()), const_cast<char*>("--fd"), fdArg, nullptr};
+        pid_t pid;
+        int rc = posix_spawn(&pid, reporterPath.c_str(), &actions, &attr, argv, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        return rc == 0;
+    }
+
+    // Reporter side: map the inherited region read-only and rebuild the CrashInfo
+    static const Record* attach(int fd) {
+        void* mem = mmap(nullptr, REGION_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED) return nullptr;
+        auto* rec = static_cast<const Record*>(mem);
+        if (std::memcmp(rec->magic, "COSREP1\0", 8) != 0 || rec->version != 7) {
+            munmap(mem, REGION_SIZE);
+            return nullptr;
+        }
+        return rec;
+    }
+
+    static CrashInfo toCrashInfo(const Record* rec) {
+        CrashInfo info;
+        info.signalName = rec->signalName;
+        info.signalNumber = rec->signalNumber;
+        info.signalCode = rec->signalCode;
+        info.signalCodeName = rec->signalCodeName;
+        info.faultDescription = rec->faultDescription;
+        info.faultAddress = rec->faultAddress;
+        info.programCounter = rec->programCounter;
+        info.stackPointer = rec->stackPointer;
+        for (uint32_t i = 0; i < rec->registerCount && i < 64; i++) {
+            info.registers.emplace_back(rec->registerNames[i], rec->registers[i]);
+        }
+        for (uint32_t i = 0; i < rec->breadcrumbCount && i < 64; i++) {
+            const auto& crumb = rec->breadcrumbs[i];
+            info.breadcrumbs.push_back({std::string(crumb.category, strnlen(crumb.category, sizeof(crumb.category))),
+                                        crumb.id, crumb.tid, crumb.a, crumb.b, crumb.agoUs});
+        }
+        for (uint32_t i = 0; i < rec->annotationCount && i < 64; i++) {
+            const auto& note = rec->annotations[i];
+            info.annotations.emplace_back(std::string(note.key, strnlen(note.key, sizeof(note.key))),
+                                          std::string(note.value, strnlen(note.value, sizeof(note.value))));
+        }
+        const char* area = reinterpret_cast<const char*>(rec + 1);
+        info.stackTrace.assign(area, rec->stackTraceSize);
+        area += rec->stackTraceSize;
+        info.throwSiteTrace.assign(area, rec->throwSiteSize);
+        area += rec->throwSiteSize;
+        info.exceptionType = rec->exceptionType;
+        info.exceptionWhat = rec->exceptionWhat;
+        info.threadStacks.assign(area, rec->threadStacksSize);
+        area += rec->threadStacksSize;
+        info.metrics.assign(area, rec->metricsSize);
+        area += rec->metricsSize;
+        info.resourceTrend.assign(area, rec->resourceTrendSize);
+        area += rec->resourceTrendSize;
+        info.lockContention.assign(area, rec->lockContentionSize);
+        area += rec->lockContentionSize;
+        info.logContent.assign(area, rec->logTailSize);
+        info.timestamp = rec->timestamp;
+        info.logPath = rec->logPath;
+        info.snapshotPath = rec->snapshotPath;
+        info.executableName = rec->executableName;
+        info.startTime = rec->startTime;
+        info.sessionDurationMs = rec->sessionDurationMs;
+        return info;
+    }
+
+    // Reporter side "Restart": same binary, argv and working directory as the crashed process
+    static bool relaunch(const Record* rec) {
+        std::vector<std::string> args = arguments(rec);
+        if (args.empty()) args.emplace_back(rec->executablePath);
+        std::vector<char*> argv;
+        for (std::string& arg : args) argv.push_back(&arg[0]);
+        argv.push_back(nullptr);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawnattr_t attr;
+        posix_spawn_file_actions_init(&actions);
+        if (rec->workingDirectory[0]) posix_spawn_file_actions_addchdir_np(&actions, rec->workingDirectory);
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        setenv(RESTART_ENV, std::to_string(static_cast<long long>(now.tv_sec) * 1000000000LL + now.tv_nsec).c_str(), 1);
+        pid_t pid;
+        int rc = posix_spawn(&pid, rec->executablePath, &actions, &attr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        return rc == 0;
+    }
+
+    static std::vector<std::string> arguments(const Record* rec) {
+        std::vector<std::string> args;
+        const char* p = rec->arguments;
+        const char* end = p + (rec->argumentsSize < sizeof(rec->arguments) ? rec->argumentsSize : sizeof(rec->arguments));
+        while (p < end) {
+            size_t len = strnlen(p, static_cast<size_t>(end - p));
+            args.emplace_back(p, len);
+            p += len + 1;
+        }
+        return args;
+    }
+};
+#endif
+
+class COS {
+public:
+    using CrashCallback = std::function<void(const CrashInfo&)>;
+
+private:
+    std::stringstream capturedOutput;
+    // held around every write into capturedOutput; app threads write through the tees while the
+    // watchdog or a crashing thread may be the one reading it
+    mutable std::timed_mutex captureLock;
+    std::streambuf* originalCoutBuffer;
+    std::streambuf* originalCerrBuffer;
+    std::string logPath;
+    std::atomic<bool> logSaved;
+    std::string executableName;
+    std::string startTime;
+    std::string stackTrace;
+    CrashCallback crashCallback;
+#ifndef _WIN32
+    COSDebuginfod debuginfod;
+    // set for the crash path: symbolize from local debug info only, fetch the rest after the log is written
+    bool deferSymbols = false;
+    mutable std::vector<std::string> deferredBuildIds;
+    std::string pendingDebuginfo;
+    static constexpr int MAX_FRAMES = 64;
+    void* crashFrames[MAX_FRAMES];
+    int crashFrameCount;
+    std::string snapshotPath;
+    size_t snapshotLimit;
+    size_t snapshotSize;
+    siginfo_t crashSiginfo;
+    ucontext_t crashContext;
+    bool hasCrashContext;
+    uint8_t* altStack;
+
+    // Every other thread unwinds itself into one of these when poked with threadDumpSignal
+    struct ThreadSlot {
+        std::atomic<int> state;
+        pid_t tid;
+        int frameCount;
+        long long pauseNs;
+        void* frames[MAX_FRAMES];
+    };
+    enum ThreadSlotState { SlotFree = 0, SlotRequested = 1, SlotDone = 2 };
+    static constexpr int MAX_THREAD_SLOTS = 256;
+    inline static ThreadSlot threadSlots[MAX_THREAD_SLOTS];
+    inline static int threadDumpSignal = 0;
+    int threadCaptureTimeoutMs;
+    std::string threadStacks;
+    int threadCount;
+    int threadsCaptured;
+    int threadSlotsUsed = 0;
+    long long threadCaptureUs;
+    long long threadMaxPauseUs;
+
+    // The watchdog thread sleeps on watchdogArm until a crash starts; if the crash path is
+    // not finished (or disarmed by the callback) within the budget it writes what it has and
+    // re-raises with the default disposition. It never allocates: the crashed thread may hold the heap lock.
+    enum CrashStage { StageIdle, StageEntered, StageTraced, StageThreads, StageSnapshot, StageSaved, StageCallback };
+    std::thread watchdogThread;
+    // only when the watchdog could not start: takes SIGTERM/SIGINT shutdowns off the handler
+    std::thread shutdownThread;
+    sem_t watchdogArm;
+    sem_t watchdogDone;
+    std::atomic<bool> watchdogArmed;
+    std::atomic<bool> watchdogStop;
+    std::atomic<int> crashStage;
+    // the fault trace as the watchdog may read it: filled before StageTraced, never touched after
+    static constexpr size_t WATCHDOG_TRACE_SIZE = 16 * 1024;
+    char watchdogTrace[WATCHDOG_TRACE_SIZE] = {};
+    int crashSignal;
+    int crashTimeBudgetMs;
+    timespec crashBegin;
+
+    CrashReportChannel reportChannel;
+    std::string reporterPath;
+
+    inline static size_t heapSampleBytes = 0;
+    inline static bool lockProfiling = false;
+    std::string lockContention;
+
+    static constexpr size_t CRUMBS_IN_REPORT = 64;
+    Breadcrumbs::Crumb crumbs[CRUMBS_IN_REPORT];
+    size_t crumbCount = 0;
+    uint64_t crumbsTakenNs = 0;
+    Annotations::Entry annotations[Annotations::CAPACITY];
+    size_t annotationCount = 0;
+
+    SamplingProfiler profiler;
+    inline static int profilerRate = 0;
+    inline static size_t profilerCapacity = 8192;
+    int profileDumps;
+    std::string profilePath;
+    size_t profileSamples;
+
+    inline static size_t traceCapacity = 0;
+    inline static bool traceMarker = false;
+    int traceDumps;
+    std::string tracePath;
+    size_t traceEvents;
+
+    inline static int metricsIntervalMs = 10000;
+    std::string metricsPath;
+    std::string metricsText;
+    long long metricsDueNs;
+
+    static constexpr size_t RESOURCE_LOG_SAMPLES = 300;
+    ResourceSampler resources;
+    inline static int resourceIntervalMs = 1000;
+    long long resourceDueNs;
+    std::string resourceTrend;
+#endif
+
+    std::chrono::system_clock::time_point startTimePoint;
+    long long saveLogUs = 0;
+
+    inline static COS* globalInstance = nullptr;
+
+    class TeeStreambuf : public std::streambuf {
+    public:
+        static constexpr int FLUSH_BUCKETS = 40;
+        static constexpr int CAPTURE_LOCK_WAIT_MS = 100;
+
+        // What COS itself costs on this stream; relaxed counters, the stream may be written from any thread
+        struct Counters {
+            std::atomic<uint64_t> bytes{0};
+            std::atomic<uint64_t> lines{0};
+            std::atomic<uint64_t> writes{0};
+            std::atomic<uint64_t> dropped{0};
+            std::atomic<uint64_t> consoleNs{0};
+            // longest write+flush, precisely timed; single characters are not in it
+            std::atomic<uint64_t> consoleMaxNs{0};
+            std::atomic<uint64_t> flushes{0};
+            // flush latency, bucket i counts flushes under 2^i ns
+            std::atomic<uint64_t> flushBuckets[FLUSH_BUCKETS] = {};
+        };
+
+    private:
+        std::streambuf* console;
+        std::streambuf* captureBuffer;
+        std::timed_mutex* lock;
+        int stream;
+        std::atomic<bool> capturing;
+        Counters counters;
+
+        static uint64_t elapsedNs(std::chrono::steady_clock::time_point since) {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - since).count());
+        }
+
+        // Single characters are timed on the tick clock: a few ns to read, and summed over many writes
+        // it still adds up to the real blocked time, but one write is rounded to the tick (1-4 ms), so
+        // they only go into the sum
+        static uint64_t tickNs() {
+#ifndef _WIN32
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+            return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+#else
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+        }
+
+        inline void noteConsole(uint64_t ns) { counters.consoleNs.fetch_add(ns, std::memory_order_relaxed); }
+
+        inline void noteConsoleMax(uint64_t ns) {
+            uint64_t max = counters.consoleMaxNs.load(std::memory_order_relaxed);
+            while (ns > max && !counters.consoleMaxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+        }
+
+        inline void noteFlush(uint64_t ns) {
+            int bucket = 0;
+            while (bucket < FLUSH_BUCKETS - 1 && (ns >> bucket) > 0) bucket++;
+            counters.flushes.fetch_add(1, std::memory_order_relaxed);
+            counters.flushBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        }
+
+    public:
+        TeeStreambuf(std::streambuf* console, std::streambuf* captureBuffer, std::timed_mutex* lock, int stream)
+            : console(console), captureBuffer(captureBuffer), lock(lock), stream(stream), capturing(true) {}
+
+        inline const Counters& getCounters() const { return counters; }
+
+        // the console keeps getting everything, the capture nothing more
+        inline void stopCapture() { capturing.store(false, std::memory_order_relaxed); }
+
+    protected:
+        inline int overflow(int c) override {
+            if (c == EOF) return !EOF;
+            uint64_t began = tickNs();
+            console->sputc(c);
+            noteConsole(tickNs() - began);
+            char ch = static_cast<char>(c);
+            capture(&ch, 1);
+            return c;
+        }
+
+        // The console write and its flush are what can block the caller. Next to the flush's syscall
+        // the precise clock costs nothing, so these writes give the max and the flush its histogram entry
+        inline std::streamsize xsputn(const char* s, std::streamsize n) override {
+            auto began = std::chrono::steady_clock::now();
+            console->sputn(s, n);
+            uint64_t writeNs = elapsedNs(began);
+            console->pubsync();
+            uint64_t ns = elapsedNs(began);
+            noteConsole(ns);
+            noteConsoleMax(ns);
+            noteFlush(ns - writeNs);
+            capture(s, n);
+            return n;
+        }
+
+        inline int sync() override {
+            COS_PROBE1(flush, stream);
+            auto began = std::chrono::steady_clock::now();
+            int rc = console->pubsync();
+            noteFlush(elapsedNs(began));
+            return rc;
+        }
+
+        // A crash inside a capture leaves the lock with the crashing thread, whose report then
+        // writes through here too: past the wait the write goes to the console only
+        inline bool lockCapture(std::unique_lock<std::timed_mutex>& guard, const char* s, std::streamsize n) {
+            if (!guard.try_lock_for(std::chrono::milliseconds(CAPTURE_LOCK_WAIT_MS))) {
+                count(s, n, 0);
+                return false;
+            }
+            return capturing.load(std::memory_order_relaxed);
+        }
+
+        inline void count(const char* s, std::streamsize n, std::streamsize kept) {
+            counters.writes.fetch_add(1, std::memory_order_relaxed);
+            counters.bytes.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+            counters.lines.fetch_add(static_cast<uint64_t>(std::count(s, s + n, '\n')), std::memory_order_relaxed);
+            if (kept < n) counters.dropped.fetch_add(static_cast<uint64_t>(n - kept), std::memory_order_relaxed);
+        }
+
+#ifndef _WIN32
+        // A capture buffer that cannot grow must not take the console stream down with it.
+        // The probe fires per captured write; a line arrives in one or more of them.
+        inline void capture(const char* s, std::streamsize n) {
+            COS_PROBE3(line_captured, stream, s, n);
+            std::unique_lock<std::timed_mutex> guard(*lock, std::defer_lock);
+            if (!lockCapture(guard, s, n)) return;
+            if (!oomMode.load(std::memory_order_relaxed)) {
+                try {
+                    count(s, n, captureBuffer->sputn(s, n));
+                    return;
+                } catch (const std::bad_alloc&) {
+                    enterOomMode();
+                }
+            }
+            oomCapturePut(s, static_cast<size_t>(n));
+            count(s, n, n);
+        }
+#else
+        inline void capture(const char* s, std::streamsize n) {
+            (void)stream;
+            std::unique_lock<std::timed_mutex> guard(*lock, std::defer_lock);
+            if (!lockCapture(guard, s, n)) return;
+            count(s, n, captureBuffer->sputn(s, n));
+        }
+#endif
+    };
+
+    TeeStreambuf* coutBuffer;
+    TeeStreambuf* cerrBuffer;
+
+    inline std::string getTimestampForFilename() const {
+        auto now = std::chrono::system_clock::now();
+        auto time = std::chrono::system_clock::to_time_t(now);
+        std::tm tm;
+
+#ifdef _WIN32
+        localtime_s(&tm, &time);
+#else
+        localtime_r(&time, &tm);
+#endif
+
+        std::ostringstream oss;
+        oss << std::put_time(&tm, "%Y-%m-%d_%H-%M-%S");
+        return oss.str();
+    }
+
+    inline std::string getTimestampForLog() const {
+        auto now = std::chrono::system_clock::now();
+        auto time = std::chrono::system_clock::to_time_t(now);
+        std::tm tm;
+
+#ifdef _WIN32
+        localtime_s(&tm, &time);
+#else
+        localtime_r(&time, &tm);
+#endif
+
+        std::ostringstream oss;
+        oss << std::put_time(&tm, "%Y/%m/%d %H:%M:%S");
+        return oss.str();
+    }
+
+    std::string getExecutableNameInternal() const {
+#ifdef _WIN32
+        char path[MAX_PATH];
+        GetModuleFileNameA(NULL, path, MAX_PATH);
+        std::string fullPath(path);
+        size_t pos = fullPath.find_last_of("\\/");
+        std::string exeName = (pos == std::string::npos) ? fullPath : fullPath.substr(pos + 1);
+        size_t extPos = exeName.find_last_of('.');
+        if (extPos != std::string::npos) {
+            exeName = exeName.substr(0, extPos);
+        }
+        return exeName;
+#else
+        char path[PATH_MAX];
+        ssize_t count = readlink("/proc/self/exe", path, PATH_MAX);
+        if (count != -1) {
+            path[count] = '\0';
+            std::string fullPath(path);
+            size_t pos = fullPath.find_last_of('/');
+            return (pos == std::string::npos) ? fullPath : fullPath.substr(pos + 1);
+        }
+        return "app";
+#endif
+    }
+
+    inline std::string getTempDir() const {
+        std::string appid = executableName;
+        std::string timestamp = getTimestampForFilename();
+
+#ifdef _WIN32
+        const char* tempDir = std::getenv("TEMP");
+        if (!tempDir) tempDir = std::getenv("TMP");
+        if (!tempDir) tempDir = "C:\\Temp";
+        return std::string(tempDir) + "\\" + appid + "_" + timestamp + ".log";
+#else
+        return "/tmp/" + appid + "_" + timestamp + ".log";
+#endif
+    }
+
+#ifndef _WIN32
+    std::string formatFrames(void* const* buffer, int numFrames) const {
+        std::stringstream ss;
+        char** symbols = backtrace_symbols(buffer, numFrames);
+        std::vector<std::string> resolved = debuginfod.symbolize(buffer, numFrames, deferSymbols ? &deferredBuildIds : nullptr);
+
+        if (symbols) {
+            for (int i = 0; i < numFrames; i++) {
+                ss << (resolved[i].empty() ? symbols[i] : resolved[i]) << "\n";
+            }
+            free(symbols);
+        }
+        return ss.str();
+    }
+
+    std::string captureStackTrace() {
+        crashFrameCount = backtrace(crashFrames, MAX_FRAMES);
+        return formatFrames(crashFrames, crashFrameCount);
+    }
+
+    // A crash makes no network requests: frames only a debuginfod server could resolve are listed in
+    // the log, with the servers to ask, and cosec-reporter (or a later `cosec-reporter --resolve <log>`)
+    // fetches and resolves them out of process
+    void listPendingFrames() {
+        if (deferredBuildIds.empty()) return;
+        std::vector<void*> frames(crashFrames, crashFrames + crashFrameCount);
+        for (int i = 0; i < threadSlotsUsed; i++) {
+            const ThreadSlot& slot = threadSlots[i];
+            if (slot.state.load(std::memory_order_acquire) != SlotDone) continue;
+            frames.insert(frames.end(), slot.frames, slot.frames + slot.frameCount);
+        }
+        std::string list = COSDebuginfod::pendingFrames(frames.data(), static_cast<int>(frames.size()), deferredBuildIds);
+        if (!list.empty()) {
+            pendingDebuginfo = "servers: " + debuginfod.getUrls() + "\ncache: " + debuginfod.getCacheDir() + "\n" + list;
+        }
+    }
+
+    static void threadDumpHandler(int, siginfo_t*, void*) {
+        int savedErrno = errno;
+        pid_t self = static_cast<pid_t>(syscall(SYS_gettid));
+        for (ThreadSlot& slot : threadSlots) {
+            if (slot.tid == self && slot.state.load(std::memory_order_acquire) == SlotRequested) {
+                timespec entered, left;
+                clock_gettime(CLOCK_MONOTONIC, &entered);
+                slot.frameCount = backtrace(slot.frames, MAX_FRAMES);
+                clock_gettime(CLOCK_MONOTONIC, &left);
+                slot.pauseNs = (left.tv_sec - entered.tv_sec) * 1000000000LL + (left.tv_nsec - entered.tv_nsec);
+                slot.state.store(SlotDone, std::memory_order_release);
+                break;
+            }
+        }
+        errno = savedErrno;
+    }
+
+    // Signals every thread listed in /proc/self/task and waits (bounded) for each to fill its slot.
+    // Uses raw getdents64 and no allocation until the stacks are formatted.
+    void captureAllThreads() {
+        threadStacks.clear();
+        threadCount = threadsCaptured = threadSlotsUsed = 0;
+        threadCaptureUs = threadMaxPauseUs = 0;
+        if (threadCaptureTimeoutMs <= 0 || threadDumpSignal == 0) return;
+
+        auto begin = std::chrono::steady_clock::now();
+        pid_t pid = getpid();
+        pid_t self = static_cast<pid_t>(syscall(SYS_gettid));
+        int used = 0;
+
+        int dir = open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir < 0) return;
+        static char dents[8192];
+        long n;
+        while ((n = syscall(SYS_getdents64, dir, dents, sizeof(dents))) > 0) {
+            for (long off = 0; off < n; ) {
+                // linux_dirent64: d_ino, d_off, d_reclen, d_type, d_name
+                unsigned short reclen;
+                std::memcpy(&reclen, dents + off + 16, sizeof(reclen));
+                const char* name = dents + off + 19;
+                off += reclen;
+                if (name[0] < '0' || name[0] > '9') continue;
+                pid_t tid = static_cast<pid_t>(std::atol(name));
+                if (tid == self) continue;
+                threadCount++;
+                if (used == MAX_THREAD_SLOTS) continue;
+
+                ThreadSlot& slot = threadSlots[used++];
+                slot.tid = tid;
+                slot.frameCount = 0;
+                slot.state.store(SlotRequested, std::memory_order_release);
+                if (syscall(SYS_tgkill, pid, tid, threadDumpSignal) != 0) {
+                    slot.state.store(SlotFree, std::memory_order_release);
+                }
+            }
+        }
+        close(dir);
+
+        auto deadline = begin + std::chrono::milliseconds(threadCaptureTimeoutMs);
+        while (true) {
+            int pending = 0;
+            for (int i = 0; i < used; i++) {
+                if (threadSlots[i].state.load(std::memory_order_acquire) == SlotRequested) pending++;
+            }
+            if (pending == 0 || std::chrono::steady_clock::now() >= deadline) break;
+            timespec pause{0, 200000};
+            nanosleep(&pause, nullptr);
+        }
+        threadSlotsUsed = used;
+        for (int i = 0; i < used; i++) {
+            if (threadSlots[i].state.load(std::memory_order_acquire) != SlotDone) continue;
+            threadsCaptured++;
+            threadMaxPauseUs = std::max(threadMaxPauseUs, threadSlots[i].pauseNs / 1000);
+        }
+        threadStacks = formatThreadStacks();
+        // symbolizing is part of what the capture cost
+        threadCaptureUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - begin).count();
+    }
+
+    // All captured threads are symbolized as one batch, so debug info is looked up (and, outside a
+    // crash, fetched) once per build-id under a single deadline rather than once per thread.
+    std::string formatThreadStacks() const {
+        std::vector<void*> frames;
+        for (int i = 0; i < threadSlotsUsed; i++) {
+            const ThreadSlot& slot = threadSlots[i];
+            if (slot.state.load(std::memory_order_acquire) != SlotDone) continue;
+            frames.insert(frames.end(), slot.frames, slot.frames + slot.frameCount);
+        }
+        int total = static_cast<int>(frames.size());
+        char** symbols = total > 0 ? backtrace_symbols(frames.data(), total) : nullptr;
+        std::vector<std::string> resolved = debuginfod.symbolize(frames.data(), total,
+                                                                 deferSymbols ? &deferredBuildIds : nullptr);
+
+        std::stringstream ss;
+        int next = 0;
+        for (int i = 0; i < threadSlotsUsed; i++) {
+            const ThreadSlot& slot = threadSlots[i];
+            std::string comm;
+            std::ifstream commFile("/proc/self/task/" + std::to_string(slot.tid) + "/comm");
+            std::getline(commFile, comm);
+
+            ss << "Thread " << slot.tid << " (" << comm << "):\n";
+            if (slot.state.load(std::memory_order_acquire) == SlotDone) {
+                for (int f = 0; f < slot.frameCount && symbols; f++, next++) {
+                    ss << (resolved[next].empty() ? symbols[next] : resolved[next]) << "\n";
+                }
+                ss << "\n";
+            } else {
+                ss << "  <no response within " << threadCaptureTimeoutMs << " ms>\n\n";
+            }
+        }
+        free(symbols);
+        return ss.str();
+    }
+
+    // Live diagnostics: the diagnostic signal only wakes the watchdog thread, which samples every
+    // thread through the same slots as a crash, so each thread is paused just for its own unwind.
+    inline static int diagnosticSignal = SIGUSR1;
+    std::atomic<bool> diagnosticRequested;
+    // Snapshots and the crash path share the thread capture state (threadStacks, the slots); a crash
+    // takes this for good, and waits for a snapshot in progress only so long
+    std::timed_mutex diagnosticLock;
+    std::atomic<bool> crashing;
+    static constexpr int CRASH_SNAPSHOT_WAIT_MS = 1000;
+    int diagnosticCount;
+    std::string lastDiagnosticPath;
+
+    static void diagnosticHandler(int) {
+        int savedErrno = errno;
+        if (globalInstance && globalInstance->watchdogThread.joinable()) {
+            globalInstance->diagnosticRequested.store(true);
+            sem_post(&globalInstance->watchdogArm);
+        }
+        errno = savedErrno;
+    }
+
+    std::string writeDiagnosticSnapshot(const std::string& trigger) {
+        if (oomMode.load()) return "";
+        std::unique_lock<std::timed_mutex> guard(diagnosticLock, std::defer_lock);
+        while (!guard.try_lock_for(std::chrono::milliseconds(100))) {
+            if (crashing.load()) return "";
+        }
+        if (crashing.load()) return "";
+        long long began = monotonicNs();
+
+        // the requesting thread is skipped by captureAllThreads, unwind it here unless it is ours
+        std::string callerStack;
+        if (!watchdogThread.joinable() || std::this_thread::get_id() != watchdogThread.get_id()) {
+            void* frames[MAX_FRAMES];
+            callerStack = formatFrames(frames, backtrace(frames, MAX_FRAMES));
+        }
+        captureAllThreads();
+        std::string stacks;
+        stacks.swap(threadStacks);
+        int count = threadCount, captured = threadsCaptured;
+        long long captureUs = threadCaptureUs, maxPauseUs = threadMaxPauseUs;
+        threadCount = threadsCaptured = 0;
+        threadCaptureUs = threadMaxPauseUs = 0;
+        std::string logTail;
+        {
+            std::lock_guard<std::timed_mutex> capture(captureLock);
+            logTail = capturedOutput.str();
+        }
+
+        std::string path = logPath.substr(0, logPath.size() - 4) + "_diag" + std::to_string(++diagnosticCount) +
+                           "_" + getTimestampForFilename() + ".log";
+        std::ofstream out(path);
+        if (!out.is_open()) return "";
+
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        auto uptimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now() - startTimePoint).count();
+        out << "------------------------------------------ DIAGNOSTIC -------------------------------------------\n"
+            << "App: " << executableName << " (pid " << getpid() << ")\n"
+            << "Start: " << startTime << "\n"
+            << "Taken: " << getTimestampForLog() << " (" << trigger << ", #" << diagnosticCount << ")\n"
+            << "Uptime: " << uptimeMs << " ms\n"
+            << "Log: " << logPath << "\n"
+            << "Captured output: " << logTail.size() << " bytes\n"
+            << "Threads: " << captured << "/" << count << " captured in " << captureUs / 1000.0
+            << " ms, longest pause " << maxPauseUs / 1000.0 << " ms\n"
+            << "Max RSS: " << usage.ru_maxrss << " KiB, CPU user " << usage.ru_utime.tv_sec * 1000 + usage.ru_utime.tv_usec / 1000
+            << " ms, system " << usage.ru_stime.tv_sec * 1000 + usage.ru_stime.tv_usec / 1000 << " ms\n"
+            << "Context switches: " << usage.ru_nvcsw << " voluntary, " << usage.ru_nivcsw << " involuntary\n"
+            << "Recent crashes: " << recentCrashes << (safeMode ? " (safe mode)" : "") << "\n";
+        if (getStandbyPid() > 0) out << "Standby: pid " << standbyPid << "\n";
+
+        const size_t tailLimit = 64 * 1024;
+        out << "\n----------------------------------------- CAPTURED LOGS -----------------------------------------\n"
+            << (logTail.size() > tailLimit ? "[...]\n" + logTail.substr(logTail.size() - tailLimit) : logTail);
+        if (HeapProfiler::getSampleCount() > 0) out << heapProfileReport(10);
+        if (LockProfiler::getContendedCount() > 0) out << lockContentionReport(10);
+        {
+            Annotations::Entry current[Annotations::CAPACITY];
+            size_t count = Annotations::snapshot(current, Annotations::CAPACITY);
+            if (count > 0) out << " ANNOTATIONS :" << irs() << formatAnnotations(current, count) << irs();
+        }
+        {
+            Breadcrumbs::Crumb recent[32];
+            size_t count = Breadcrumbs::newest(recent, 32);
+            if (count > 0) {
+                out << " BREADCRUMBS (newest " << count << ") :" << irs()
+                    << formatBreadcrumbs(recent, count, static_cast<uint64_t>(monotonicNs())) << irs();
+            }
+        }
+        out << formatStats();
+        if (!callerStack.empty()) out << " REQUESTING THREAD :" << irs() << callerStack << irs();
+        if (!stacks.empty()) out << " OTHER THREADS :" << irs() << stacks << irs();
+
+        out << "\nSnapshot written in " << (monotonicNs() - began) / 1e6 << " ms\n";
+        lastDiagnosticPath = path;
+        return path;
+    }
+
+    static const char* getCrashStageName(int stage) {
+        switch (stage) {
+        case StageEntered: return "capturing stack trace";
+        case StageTraced: return "capturing other threads";
+        case StageThreads: return "writing snapshot";
+        case StageSnapshot: return "saving log";
+        case StageSaved: return "building crash report";
+        case StageCallback: return "running crash callback";
+        default: return "idle";
+        }
+    }
+
+    static void writeRaw(int fd, const char* text) {
+        size_t len = std::strlen(text);
+        while (len > 0) {
+            ssize_t n = ::write(fd, text, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            text += n;
+            len -= static_cast<size_t>(n);
+        }
+    }
+
+    static void writeRaw(int fd, long long value) {
+        char digits[24];
+        char* p = digits + sizeof(digits);
+        *--p = '\0';
+        bool negative = value < 0;
+        unsigned long long v = negative ? 0ULL - static_cast<unsigned long long>(value) : static_cast<unsigned long long>(value);
+        do { *--p = static_cast<char>('0' + v % 10); v /= 10; } while (v);
+        if (negative) *--p = '-';
+        writeRaw(fd, p);
+    }
+
+    // Throw-site capture: every throw (through the COS_THROW_HOOK __cxa_throw) lands in a small ring
+    // with its type, what() and, for one throw in throwStackEvery, a backtrace. The terminate handler
+    // matches the uncaught exception against the ring, so the report shows where it was thrown.
+    static constexpr int THROW_RING = 16;
+    static constexpr int THROW_FRAMES = 32;
+    struct ThrowRecord {
+        std::atomic<unsigned> seq;
+        const std::type_info* type;
+        pid_t tid;
+        long long ns;
+        int frameCount;
+        void* frames[THROW_FRAMES];
+        char what[160];
+    };
+    inline static ThrowRecord throwRing[THROW_RING];
+    inline static std::atomic<unsigned long long> throwCount{0};
+    inline static std::atomic<bool> throwCaptureOn{false};
+    // a backtrace is the expensive part of a throw; the first one always gets it
+    inline static int throwStackEvery = 64;
+    inline static std::terminate_handler previousTerminate = nullptr;
+
+    std::string uncaughtType;
+    std::string uncaughtWhat;
+    std::string throwSiteTrace;
+
+    static std::string demangle(const char* name) {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        std::string result = (status == 0 && demangled) ? demangled : name;
+        free(demangled);
+        return result;
+    }
+
+    // Consistent copy of one ring slot, false while a writer is inside it
+    static bool readThrow(int index, ThrowRecord& out) {
+        ThrowRecord& slot = throwRing[index];
+        unsigned before = slot.seq.load(std::memory_order_acquire);
+        if (before == 0 || (before & 1)) return false;
+        out.type = slot.type;
+        out.tid = slot.tid;
+        out.ns = slot.ns;
+        out.frameCount = slot.frameCount;
+        std::memcpy(out.frames, slot.frames, sizeof(out.frames));
+        std::memcpy(out.what, slot.what, sizeof(out.what));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.seq.load(std::memory_order_relaxed) == before;
+    }
+
+    static void terminateHandler() {
+        if (globalInstance && !oomMode.load()) globalInstance->noteUncaught();
+        // libstdc++'s verbose handler still prints its line and aborts, which lands in handleSignal
+        if (previousTerminate) previousTerminate();
+        std::abort();
+    }
+
+    void noteUncaught() {
+        std::exception_ptr current = std::current_exception();
+        if (!current) {
+            uncaughtType = "none (std::terminate called without an active exception)";
+            return;
+        }
+        const std::type_info* type = abi::__cxa_current_exception_type();
+        uncaughtType = type ? demangle(type->name()) : "unknown";
+        try {
+            std::rethrow_exception(current);
+        } catch (const std::exception& e) {
+            uncaughtWhat = e.what();
+        } catch (...) {
+        }
+
+        // newest throw of this type on this thread
+        pid_t self = static_cast<pid_t>(syscall(SYS_gettid));
+        unsigned long long total = throwCount.load();
+        ThrowRecord record;
+        for (unsigned long long n = total; n > 0 && total - n < THROW_RING; n--) {
+            if (!readThrow(static_cast<int>((n - 1) % THROW_RING), record)) continue;
+            if (record.tid != self || !type || *record.type != *type) continue;
+            if (record.frameCount > 0) throwSiteTrace = formatFrames(record.frames, record.frameCount);
+            break;
+        }
+    }
+
+    std::string formatRecentThrows() const {
+        std::stringstream ss;
+        long long now = monotonicNs();
+        unsigned long long total = throwCount.load();
+        ThrowRecord record;
+        for (unsigned long long n = total; n > 0 && total - n < THROW_RING; n--) {
+            if (!readThrow(static_cast<int>((n - 1) % THROW_RING), record)) continue;
+            ss << "  #" << n << "  tid " << record.tid << "  " << (now - record.ns) / 1000000 << " ms ago  "
+               << demangle(record.type->name()) << (record.what[0] ? std::string(": ") + record.what : "") << "\n";
+        }
+        return ss.str();
+    }
+
+    // OOM mode: COS keeps a touched emergency block and a new_handler. The first failed allocation
+    // releases the block and flips COS to allocation-free capture: console output is teed into a static
+    // ring instead of the stringstream, and the log is written with write(2) from what already exists.
+    inline static size_t emergencyReserveSize = 4 * 1024 * 1024;
+    inline static void* emergencyReserve = nullptr;
+    inline static std::new_handler previousNewHandler = nullptr;
+    inline static std::atomic<bool> oomMode{false};
+    inline static std::atomic<size_t> oomRequestedSize{0};
+    inline static long long oomRssKb = 0;
+    inline static std::atomic<int> oomFailures{0};
+
+    static constexpr size_t OOM_CAPTURE_SIZE = 256 * 1024;
+    inline static char oomCapture[OOM_CAPTURE_SIZE];
+    inline static size_t oomCaptured = 0;
+
+    // Reads the stringstream's buffer in place, copying it out would allocate
+    struct CaptureView : std::stringbuf {
+        static const char* begin(std::streambuf* buffer) { return (buffer->*(&CaptureView::pbase))(); }
+        static const char* end(std::streambuf* buffer) { return (buffer->*(&CaptureView::pptr))(); }
+    };
+
+    static long long readRssKb() {
+        int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return 0;
+        char buffer[64];
+        ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+        close(fd);
+        if (n <= 0) return 0;
+        buffer[n] = '\0';
+        const char* p = std::strchr(buffer, ' ');
+        return p ? std::atoll(p + 1) * (sysconf(_SC_PAGESIZE) / 1024) : 0;
+    }
+
+    static void enterOomMode() {
+        if (oomMode.exchange(true)) return;
+        oomRssKb = readRssKb();
+        writeRaw(STDERR_FILENO, "COS: out of memory");
+        if (size_t requested = oomRequestedSize.load()) {
+            writeRaw(STDERR_FILENO, " (requested ");
+            writeRaw(STDERR_FILENO, static_cast<long long>(requested));
+            writeRaw(STDERR_FILENO, " bytes)");
+        }
+        writeRaw(STDERR_FILENO, ", RSS ");
+        writeRaw(STDERR_FILENO, oomRssKb);
+        writeRaw(STDERR_FILENO, " KiB, switching to allocation-free capture\n");
+    }
+
+    static void oomNewHandler() {
+        enterOomMode();
+        if (emergencyReserve) {
+            std::free(emergencyReserve);
+            emergencyReserve = nullptr;
+            return;
+        }
+        oomFailures++;
+        if (previousNewHandler) {
+            previousNewHandler();
+            return;
+        }
+        throw std::bad_alloc();
+    }
+
+    static void oomCapturePut(const char* s, size_t n) {
+        for (size_t i = 0; i < n; i++) oomCapture[oomCaptured++ % OOM_CAPTURE_SIZE] = s[i];
+    }
+
+    // Everything the normal saveLog() writes that can be had without the heap
+    void saveLogRaw(const char* exitReason, bool withTrace) {
+        if (logSaved.exchange(true)) return;
+        stopCapture();
+        int fd = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return;
+
+        auto durationMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now() - startTimePoint).count();
+        writeRaw(fd, "--------------------------------------------- DATA ----------------------------------------------\nApp: ");
+        writeRaw(fd, executableName.c_str());
+        writeRaw(fd, "\nStart: ");
+        writeRaw(fd, startTime.c_str());
+        writeRaw(fd, "\nExit: ");
+        writeRaw(fd, exitReason);
+        writeRaw(fd, " (out of memory)\nDuration: ");
+        writeRaw(fd, static_cast<long long>(durationMs));
+        writeRaw(fd, " ms\nOut of memory: requested ");
+        size_t requested = oomRequestedSize.load();
+        if (requested) {
+            writeRaw(fd, static_cast<long long>(requested));
+            writeRaw(fd, " bytes");
+        } else {
+            writeRaw(fd, "size unknown");
+        }
+        writeRaw(fd, ", RSS ");
+        writeRaw(fd, oomRssKb);
+        writeRaw(fd, " KiB at the first failure, RSS ");
+        writeRaw(fd, readRssKb());
+        writeRaw(fd, " KiB now, ");
+        writeRaw(fd, static_cast<long long>(emergencyReserveSize / 1024));
+        writeRaw(fd, " KiB reserve released, ");
+        writeRaw(fd, static_cast<long long>(oomFailures.load()));
+        writeRaw(fd, " failures after that\n");
+        if (snapshotSize > 0) {
+            writeRaw(fd, "Snapshot: ");
+            writeRaw(fd, snapshotPath.c_str());
+            writeRaw(fd, "\n");
+        }
+
+        writeRaw(fd, "\n----------------------------------------- CAPTURED LOGS -----------------------------------------\n");
+        const char* begin = CaptureView::begin(capturedOutput.rdbuf());
+        const char* end = CaptureView::end(capturedOutput.rdbuf());
+        if (begin && end > begin) write(fd, begin, static_cast<size_t>(end - begin));
+        if (oomCaptured > 0) {
+            writeRaw(fd, "\n[out of memory, captured without allocating from here]\n");
+            size_t kept = oomCaptured < OOM_CAPTURE_SIZE ? oomCaptured : OOM_CAPTURE_SIZE;
+            size_t start = (oomCaptured - kept) % OOM_CAPTURE_SIZE;
+            size_t first = kept < OOM_CAPTURE_SIZE - start ? kept : OOM_CAPTURE_SIZE - start;
+            write(fd, oomCapture + start, first);
+            write(fd, oomCapture, kept - first);
+        }
+        if (withTrace && crashFrameCount > 0) {
+            writeRaw(fd, "\n THE SIGNAL FAULT STACK TRACE :\n");
+            backtrace_symbols_fd(crashFrames, crashFrameCount, fd);
+        }
+        close(fd);
+    }
+
+    // Crash path once memory is gone: no strings, no streams, no callback (Qt could not run anyway)
+    [[noreturn]] void handleSignalWithoutHeap(int sigNum) {
+        char name[16] = "Signal ";
+        switch (sigNum) {
+        case SIGABRT: std::strcpy(name, "SIGABRT"); break;
+        case SIGSEGV: std::strcpy(name, "SIGSEGV"); break;
+        case SIGBUS: std::strcpy(name, "SIGBUS"); break;
+        case SIGFPE: std::strcpy(name, "SIGFPE"); break;
+        case SIGILL: std::strcpy(name, "SIGILL"); break;
+        default: name[7] = static_cast<char>('0' + sigNum / 10); name[8] = static_cast<char>('0' + sigNum % 10); break;
+        }
+        writeRaw(STDERR_FILENO, "\n!!! A ");
+        writeRaw(STDERR_FILENO, name);
+        writeRaw(STDERR_FILENO, " SIGNAL FAILURE CAUGHT !!! (out of memory)\n");
+
+        crashFrameCount = backtrace(crashFrames, MAX_FRAMES);
+        backtrace_symbols_fd(crashFrames, crashFrameCount, STDERR_FILENO);
+        crashStage.store(StageTraced);
+        snapshotSize = CrashSnapshot::write(snapshotPath.c_str(), snapshotLimit, sigNum, crashSiginfo.si_code,
+                                            crashSiginfo.si_addr, &crashContext, crashFrames, crashFrameCount);
+        crashStage.store(StageSnapshot);
+
+        char reason[32] = "Crashed: ";
+        std::strcat(reason, name);
+        saveLogRaw(reason, true);
+        crashStage.store(StageSaved);
+        dieWithSignal(sigNum);
+        _exit(128 + sigNum);
+    }
+
+    // Graceful shutdown: SIGTERM/SIGINT only flag the request; the watchdog thread (otherwise idle)
+    // runs the registered hooks in parallel, drains the streams, each step against its own deadline,
+    // and writes a normal log. Whatever misses a deadline is abandoned, not waited for.
+    struct TaskBatch {
+        std::mutex lock;
+        std::condition_variable done;
+        std::vector<bool> finished;
+        size_t remaining = 0;
+    };
+
+    // Runs every task on its own detached thread; returns which ones finished within budgetMs
+    static std::vector<bool> runWithDeadline(const std::vector<std::function<void()>>& tasks, int budgetMs) {
+        auto batch = std::make_shared<TaskBatch>();
+        batch->finished.assign(tasks.size(), false);
+        batch->remaining = tasks.size();
+        for (size_t i = 0; i < tasks.size(); i++) {
+            auto task = [batch, i, fn = tasks[i]]() {
+                try {
+                    fn();
+                } catch (...) {
+                }
+                std::lock_guard<std::mutex> guard(batch->lock);
+                batch->finished[i] = true;
+                batch->remaining--;
+                batch->done.notify_all();
+            };
+            try {
+                std::thread(task).detach();
+            } catch (const std::system_error&) {
+                task();
+            }
+        }
+        std::unique_lock<std::mutex> guard(batch->lock);
+        batch->done.wait_for(guard, std::chrono::milliseconds(budgetMs), [&batch]() { return batch->remaining == 0; });
+        return batch->finished;
+    }
+
+    std::atomic<int> shutdownSignal;
+    int shutdownHookBudgetMs;
+    int shutdownDrainMs;
+    std::mutex shutdownHooksLock;
+    std::vector<std::pair<std::string, std::function<void()>>> shutdownHooks;
+
+    // Async-signal-safe; a second request while the first is still running exits at once
+    void requestShutdown(int sigNum) {
+        if (shutdownSignal.exchange(sigNum) != 0) dieWithSignal(sigNum);
+        if (watchdogThread.joinable() || shutdownThread.joinable()) {
+            sem_post(&watchdogArm);
+        } else {
+            // no thread to hand it to, and hooks, locks and streams are not for a signal handler
+            saveLogRaw(sigNum == SIGINT ? "Normal exit on SIGINT" : "Normal exit on SIGTERM", false);
+            dieWithSignal(sigNum);
+        }
+    }
+
+    void shutdownLoop() {
+        while (sem_wait(&watchdogArm) == 0 || errno == EINTR) {
+            if (watchdogStop.load()) return;
+            if (int sig = shutdownSignal.load()) gracefulShutdown(sig);
+        }
+    }
+
+    void gracefulShutdown(int sigNum) {
+        if (oomMode.load()) {
+            saveLogRaw(sigNum == SIGINT ? "Normal exit on SIGINT" : "Normal exit on SIGTERM", false);
+            dieWithSignal(sigNum);
+        }
+        long long began = monotonicNs();
+        // Status goes to the log; the console only gets it in the drain, where a stalled stdout
+        // (nobody reading the pipe) cannot hold up the exit
+        std::ostringstream status;
+        status << "\nCOS: " << getSignalName(sigNum) << " received, shutting down\n";
+
+        std::vector<std::string> names;
+        std::vector<std::function<void()>> hooks;
+        {
+            std::lock_guard<std::mutex> guard(shutdownHooksLock);
+            for (const auto& hook : shutdownHooks) {
+                names.push_back(hook.first);
+                hooks.push_back(hook.second);
+            }
+        }
+        std::vector<bool> finished = runWithDeadline(hooks, shutdownHookBudgetMs);
+        long long hooksDone = monotonicNs();
+        size_t finishedCount = std::count(finished.begin(), finished.end(), true);
+        status << "COS: shutdown hooks " << finishedCount << "/" << hooks.size() << " finished in "
+               << (hooksDone - began) / 1e6 << " ms";
+        const char* separator = ", late: ";
+        for (size_t i = 0; i < finished.size(); i++) {
+            if (finished[i]) continue;
+            status << separator << names[i];
+            separator = ", ";
+        }
+        status << "\n";
+        {
+            std::lock_guard<std::timed_mutex> guard(captureLock);
+            capturedOutput << status.str();
+        }
+
+        // past the tee, the lines are in the log already
+        bool drained = runWithDeadline({[console = originalCoutBuffer, text = status.str()]() {
+            std::cout.flush();
+            console->sputn(text.data(), static_cast<std::streamsize>(text.size()));
+            console->pubsync();
+            std::cerr.flush();
+            std::fflush(nullptr);
+        }}, shutdownDrainMs)[0];
+        long long drainDone = monotonicNs();
+        {
+            std::lock_guard<std::timed_mutex> guard(captureLock);
+            capturedOutput << "COS: output " << (drained ? "drained in " : "not drained within ")
+                           << (drained ? (drainDone - hooksDone) / 1e6 : shutdownDrainMs) << " ms, shutdown took "
+                           << (drainDone - began) / 1e6 << " ms\n";
+        }
+
+        saveLog("Normal exit on " + getSignalName(sigNum));
+        unlink(crashHistoryPath.c_str());
+        dieWithSignal(sigNum);
+    }
+
+    void watchdogLoop() {
+        while (true) {
+            // once a second (or per resource sample if sooner), give threads started since then a CPU
+            // timer of their own and do the periodic dumps
+            int periodMs = resourceIntervalMs > 0 && resourceIntervalMs < 1000 ? resourceIntervalMs : 1000;
+            timespec wakeAt;
+            clock_gettime(CLOCK_REALTIME, &wakeAt);
+            wakeAt.tv_sec += periodMs / 1000;
+            wakeAt.tv_nsec += static_cast<long>(periodMs % 1000) * 1000000L;
+            if (wakeAt.tv_nsec >= 1000000000L) {
+                wakeAt.tv_sec++;
+                wakeAt.tv_nsec -= 1000000000L;
+            }
+            if (sem_timedwait(&watchdogArm, &wakeAt) != 0) {
+                if (errno != ETIMEDOUT) continue;
+                if (profiler.isRunning()) profiler.rescan();
+                sampleResourcesIfDue();
+                dumpMetricsIfDue();
+                continue;
+            }
+            if (watchdogStop.load()) return;
+            if (int sig = shutdownSignal.load()) gracefulShutdown(sig);
+            if (!watchdogArmed.load() && diagnosticRequested.exchange(false)) {
+                std::string path = writeDiagnosticSnapshot("signal " + getSignalName(diagnosticSignal));
+                if (!path.empty()) std::cerr << "COS: diagnostic snapshot " << path << std::endl;
+                continue;
+            }
+
+            timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += crashTimeBudgetMs / 1000;
+            deadline.tv_nsec += static_cast<long>(crashTimeBudgetMs % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            int rc;
+            while ((rc = sem_timedwait(&watchdogDone, &deadline)) != 0 && errno == EINTR) {}
+            if (watchdogStop.load()) return;
+            if (rc == 0 || !watchdogArmed.load()) continue;
+
+            watchdogFire();
+        }
+    }
+
+    // Both run on the watchdog thread between its waits
+    void sampleResourcesIfDue() {
+        if (resourceIntervalMs <= 0 || monotonicNs() < resourceDueNs) return;
+        resourceDueNs = monotonicNs() + resourceIntervalMs * 1000000LL;
+        resources.sample();
+    }
+
+    void dumpMetricsIfDue() {
+        if (metricsIntervalMs <= 0 || monotonicNs() < metricsDueNs) return;
+        metricsDueNs = monotonicNs() + metricsIntervalMs * 1000000LL;
+        if (Metrics::size() == 0) return;
+        // the watchdog must not hang on a lock a crashed thread holds, a busy registry skips a period
+        std::string text = Metrics::prometheusText(false);
+        if (!text.empty()) Metrics::writePrometheus(metricsPath, text);
+    }
+
+    void watchdogFire() {
+        int stage = crashStage.load();
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long elapsedMs = (now.tv_sec - crashBegin.tv_sec) * 1000LL + (now.tv_nsec - crashBegin.tv_nsec) / 1000000LL;
+
+        int fd = open(logPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            writeRaw(fd, "\n------------------------------------------- WATCHDOG --------------------------------------------\n");
+            writeRaw(fd, "App: ");
+            writeRaw(fd, executableName.c_str());
+            writeRaw(fd, "\nCrash handling for signal ");
+            writeRaw(fd, static_cast<long long>(crashSignal));
+            writeRaw(fd, " exceeded its budget: ");
+            writeRaw(fd, elapsedMs);
+            writeRaw(fd, " ms (budget ");
+            writeRaw(fd, static_cast<long long>(crashTimeBudgetMs));
+            writeRaw(fd, " ms), stuck while ");
+            writeRaw(fd, getCrashStageName(stage));
+            writeRaw(fd, "\n");
+            // only read what the crashed thread has finished writing, and never the std::string it
+            // may still reassign or free
+            if (stage >= StageTraced && stage < StageSaved && watchdogTrace[0]) {
+                writeRaw(fd, " THE SIGNAL FAULT STACK TRACE :\n");
+                writeRaw(fd, watchdogTrace);
+            }
+            close(fd);
+        }
+
+        writeRaw(STDERR_FILENO, "COS: crash handler timed out, terminating\n");
+        signal(crashSignal, SIG_DFL);
+        kill(getpid(), crashSignal);
+        _exit(128 + crashSignal);
+    }
+
+    static void dieWithSignal(int sigNum) {
+        signal(sigNum, SIG_DFL);
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, sigNum);
+        pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+        raise(sigNum);
+        _exit(128 + sigNum);
+    }
+
+    inline void armWatchdog(int sigNum) {
+        if (crashTimeBudgetMs <= 0 || !watchdogThread.joinable() || watchdogArmed.exchange(true)) return;
+        crashSignal = sigNum;
+        clock_gettime(CLOCK_MONOTONIC, &crashBegin);
+        crashStage.store(StageEntered);
+        sem_post(&watchdogArm);
+    }
+
+    // Supervisor mode: the process forks while COS is constructed. The parent stays behind as a
+    // small supervisor that tees the child's stdout/stderr from pipes into the log and watches a
+    // pidfd, so even SIGKILL and OOM kills end with a complete log. Construct COS before any
+    // thread is started, the restart path forks from that early state again.
+    inline static bool supervisorRequested = false;
+    inline static bool supervisorRestart = false;
+    inline static int supervisorMaxRestarts = 3;
+    bool supervised;
+
+    static bool supervisorEnabled() {
+        const char* env = std::getenv("COS_SUPERVISE");
+        if (env && *env && std::strcmp(env, "0") != 0) {
+            supervisorRequested = true;
+            if (std::strcmp(env, "restart") == 0) supervisorRestart = true;
+        }
+        return supervisorRequested;
+    }
+
+    void supervisorNote(const std::string& line) {
+        capturedOutput << line << "\n";
+        std::string text = line + "\n";
+        writeRaw(STDERR_FILENO, text.c_str());
+    }
+
+    // cgroup v2 oom_kill counter of our own cgroup, -1 when it cannot be read
+    static long long readOomKills() {
+        std::ifstream cgroup("/proc/self/cgroup");
+        std::string line, path;
+        while (std::getline(cgroup, line)) {
+            if (line.compare(0, 3, "0::") == 0) path = line.substr(3);
+        }
+        std::ifstream events("/sys/fs/cgroup" + path + "/memory.events");
+        std::string key;
+        long long value;
+        while (events >> key >> value) {
+            if (key == "oom_kill") return value;
+        }
+        return -1;
+    }
+
+    static int openPidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+        return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+        (void)pid;
+        return -1;
+#endif
+    }
+
+    // Returns true in the child; the parent never returns, it exits with the child's status
+    bool superviseChild() {
+        int restarts = 0;
+        while (true) {
+            int outPipe[2], errPipe[2];
+            if (pipe2(outPipe, O_CLOEXEC) != 0) return false;
+            if (pipe2(errPipe, O_CLOEXEC) != 0) {
+                close(outPipe[0]);
+                close(outPipe[1]);
+                return false;
+            }
+            std::cout.flush();
+            std::cerr.flush();
+            long long oomBefore = readOomKills();
+
+            pid_t child = fork();
+            if (child < 0) {
+                for (int fd : {outPipe[0], outPipe[1], errPipe[0], errPipe[1]}) close(fd);
+                return false;
+            }
+            if (child == 0) {
+                dup2(outPipe[1], STDOUT_FILENO);
+                dup2(errPipe[1], STDERR_FILENO);
+                for (int fd : {outPipe[0], outPipe[1], errPipe[0], errPipe[1]}) close(fd);
+                return true;
+            }
+            close(outPipe[1]);
+            close(errPipe[1]);
+            supervisedChild = child;
+            if (restarts == 0) {
+                // the supervisor itself only forwards termination requests
+                for (int sig : {SIGTERM, SIGINT, SIGHUP, SIGQUIT}) signal(sig, forwardToChild);
+            }
+            supervisorNote("COS supervisor: child " + std::to_string(child) + " started, log " + logPath);
+
+            int status = pumpChild(child, outPipe[0], errPipe[0]);
+            close(outPipe[0]);
+            close(errPipe[0]);
+
+            std::string reason;
+            bool abnormal = true;
+            if (WIFEXITED(status)) {
+                abnormal = WEXITSTATUS(status) != 0;
+                reason = abnormal ? "Exited with code " + std::to_string(WEXITSTATUS(status)) : "Normal exit";
+            } else if (WIFSIGNALED(status)) {
+                int sig = WTERMSIG(status);
+                long long oomAfter = readOomKills();
+                reason = "Crashed: " + getSignalName(sig);
+                if (sig == SIGKILL && oomBefore >= 0 && oomAfter > oomBefore) reason += " (OOM killer)";
+                if (WCOREDUMP(status)) reason += ", core dumped";
+            }
+            supervisorNote("COS supervisor: child " + std::to_string(child) + " ended: " + reason);
+            saveLog(reason);
+
+            if (abnormal) recordCrash(WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+            if (!abnormal) unlink(crashHistoryPath.c_str());
+
+            if (!abnormal || !supervisorRestart || restarts >= supervisorMaxRestarts) {
+                if (WIFSIGNALED(status)) {
+                    // report the same death upwards, without a second core file
+                    rlimit noCore{0, 0};
+                    setrlimit(RLIMIT_CORE, &noCore);
+                    dieWithSignal(WTERMSIG(status));
+                }
+                _exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+            }
+
+            restarts++;
+            std::string previousLog = logPath;
+            logPath = getTempDir();
+            if (logPath == previousLog) logPath.insert(logPath.size() - 4, "_" + std::to_string(restarts));
+            snapshotPath = logPath.substr(0, logPath.size() - 4) + ".cosdump";
+            capturedOutput.str("");
+            logSaved = false;
+            startTimePoint = std::chrono::system_clock::now();
+            startTime = getTimestampForLog();
+            long long delay = crashLoopDelayMs(pruneCrashHistory());
+            supervisorNote("COS supervisor: restart " + std::to_string(restarts) + "/" +
+                           std::to_string(supervisorMaxRestarts) +
+                           (delay > 0 ? ", crash loop backoff " + std::to_string(delay) + " ms" : ""));
+            sleepMs(delay);
+        }
+    }
+
+    inline static pid_t supervisedChild = 0;
+
+    // Crash-loop guard: every crash appends "<epoch ms> <signal>" to a small per-executable history
+    // file. When the last crashLoopWindowSec hold crashLoopThreshold or more crashes, restarts are
+    // delayed exponentially and, if enabled, the run starts in safe mode. A clean exit clears it.
+    inline static int crashLoopThreshold = 3;
+    inline static int crashLoopWindowSec = 60;
+    inline static int crashLoopBaseDelayMs = 1000;
+    inline static int crashLoopMaxDelayMs = 30000;
+    inline static bool crashLoopSafeMode = false;
+    std::string crashHistoryPath;
+    int recentCrashes;
+    bool safeMode;
+
+    std::string getCrashHistoryPathInternal() const {
+        std::string dir;
+        if (const char* state = std::getenv("XDG_STATE_HOME")) {
+            dir = std::string(state) + "/cos";
+        } else if (const char* home = std::getenv("HOME")) {
+            dir = std::string(home) + "/.local/state/cos";
+        } else {
+            dir = "/tmp/cos-" + std::to_string(getuid());
+        }
+        for (size_t pos = 1; pos != std::string::npos; ) {
+            pos = dir.find('/', pos + 1);
+            mkdir(dir.substr(0, pos).c_str(), 0700);
+        }
+        return dir + "/" + executableName + ".crashes";
+    }
+
+    static long long epochMs() {
+        timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        return static_cast<long long>(now.tv_sec) * 1000LL + now.tv_nsec / 1000000;
+    }
+
+    // Drops entries older than the window, returns what is left. The file is only touched when
+    // something was dropped, and removed once nothing is left, so apps that never crash never have one.
+    int pruneCrashHistory() {
+        std::ifstream in(crashHistoryPath);
+        if (!in.is_open()) return 0;
+        std::vector<std::pair<long long, int>> kept;
+        long long cutoff = epochMs() - crashLoopWindowSec * 1000LL;
+        long long when;
+        int sig;
+        size_t total = 0;
+        while (in >> when >> sig) {
+            total++;
+            if (when >= cutoff) kept.emplace_back(when, sig);
+        }
+        in.close();
+
+        if (kept.size() == total) return static_cast<int>(kept.size());
+        if (kept.empty()) {
+            unlink(crashHistoryPath.c_str());
+            return 0;
+        }
+        std::ofstream out(crashHistoryPath, std::ios::trunc);
+        for (const auto& entry : kept) out << entry.first << " " << entry.second << "\n";
+        return static_cast<int>(kept.size());
+    }
+
+    // Async-signal-safe, called from the crash path
+    void recordCrash(int sigNum) {
+        int fd = open(crashHistoryPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        if (fd < 0) return;
+        writeRaw(fd, epochMs());
+        writeRaw(fd, " ");
+        writeRaw(fd, static_cast<long long>(sigNum));
+        writeRaw(fd, "\n");
+        close(fd);
+    }
+
+    long long crashLoopDelayMs(int crashes) const {
+        if (crashLoopThreshold <= 0 || crashes < crashLoopThreshold) return 0;
+        long long delay = crashLoopBaseDelayMs;
+        for (int i = crashLoopThreshold; i < crashes && delay < crashLoopMaxDelayMs; i++) delay *= 2;
+        return delay < crashLoopMaxDelayMs ? delay : crashLoopMaxDelayMs;
+    }
+
+    static void sleepMs(long long ms) {
+        timespec pause{static_cast<time_t>(ms / 1000), static_cast<long>(ms % 1000) * 1000000L};
+        while (nanosleep(&pause, &pause) != 0 && errno == EINTR) {}
+    }
+
+    // Warm standby: a second copy of the process, forked while COS is constructed and parked on a
+    // socket. A crash promotes it on the spot (one write from the signal handler), it finishes the
+    // constructor as the new instance and forks a standby of its own. fork() copies only the calling
+    // thread, so this is refused once other threads run; GUI apps, whose toolkit starts threads and a
+    // display connection with QApplication, fork earlier through prepareStandby().
+    struct StandbyWake {
+        long long crashNs;
+        pid_t crashedPid;
+        int signal;
+    };
+
+    inline static bool standbyRequested = false;
+    pid_t standbyPid;
+    int standbyFd;
+    bool standbyPromoted;
+    pid_t promotedFrom;
+
+    // Left by prepareStandby() for the COS constructed later
+    inline static pid_t preparedStandbyPid = 0;
+    inline static int preparedStandbyFd = -1;
+    inline static StandbyWake preparedWake{};
+    // crash times of the promotions so far; each standby inherits the list from the instance it copies
+    inline static long long promotionNs[8] = {};
+    inline static int promotions = 0;
+
+    static bool standbyEnabled() {
+        const char* env = std::getenv("COS_STANDBY");
+        if (env && *env && std::strcmp(env, "0") != 0) standbyRequested = true;
+        return standbyRequested;
+    }
+
+    static int threadsRunning() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 8, "Threads:") == 0) return std::atoi(line.c_str() + 8);
+        }
+        return 1;
+    }
+
+    enum StandbyRole { StandbyNone, StandbyActive, StandbyPromoted };
+
+    // Active: a standby is parked on `fd`. Promoted: this is the standby, woken by `wake`.
+    // A standby that is never promoted exits in here.
+    static StandbyRole forkStandby(pid_t& pid, int& fd, StandbyWake& wake) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) != 0) return StandbyNone;
+        std::cout.flush();
+        std::cerr.flush();
+
+        pid_t child = fork();
+        if (child < 0) {
+            close(pair[0]);
+            close(pair[1]);
+            return StandbyNone;
+        }
+        if (child > 0) {
+            close(pair[1]);
+            pid = child;
+            fd = pair[0];
+            return StandbyActive;
+        }
+
+        close(pair[0]);
+        ssize_t n;
+        do {
+            n = read(pair[1], &wake, sizeof(wake));
+        } while (n < 0 && errno == EINTR);
+        close(pair[1]);
+        // the active instance exited (or was killed) without asking for a takeover
+        if (n != static_cast<ssize_t>(sizeof(wake))) _exit(0);
+        promotionNs[promotions++ % 8] = wake.crashNs;
+        return StandbyPromoted;
+    }
+
+    // The crash-history file needs a constructed COS; before that the promotion list stands in for it
+    static bool promotionLoop() {
+        long long since = monotonicNs() - crashLoopWindowSec * 1000000000LL;
+        int recent = 0;
+        for (int i = 0; i < promotions && i < 8; i++) recent += promotionNs[i] >= since;
+        return crashLoopThreshold > 0 && recent >= crashLoopThreshold;
+    }
+
+    // Returns in the active instance only
+    void keepStandby() {
+        if (threadsRunning() > 1) {
+            std::cerr << "COS: standby refused, threads are already running (call COS::prepareStandby() first in main)"
+                      << std::endl;
+            return;
+        }
+        while (true) {
+            StandbyWake wake{};
+            if (forkStandby(standbyPid, standbyFd, wake) != StandbyPromoted) return;
+
+            standbyPromoted = true;
+            promotedFrom = wake.crashedPid;
+            restartRequestedNs = wake.crashNs;
+            std::string crashedLog = logPath;
+            logPath = getTempDir();
+            if (logPath == crashedLog) logPath.insert(logPath.size() - 4, "_" + std::to_string(getpid()));
+            snapshotPath = logPath.substr(0, logPath.size() - 4) + ".cosdump";
+            startTimePoint = std::chrono::system_clock::now();
+            startTime = getTimestampForLog();
+
+            // crashing in a loop: keep this instance, but stop burning standbys
+            recentCrashes = pruneCrashHistory();
+            if (crashLoopDelayMs(recentCrashes) > 0) {
+                standbyRequested = false;
+                return;
+            }
+        }
+    }
+
+    void adoptPreparedStandby() {
+        standbyPid = preparedStandbyPid;
+        standbyFd = preparedStandbyFd;
+        preparedStandbyFd = -1;
+        if (preparedWake.crashedPid != 0) {
+            standbyPromoted = true;
+            promotedFrom = preparedWake.crashedPid;
+            restartRequestedNs = preparedWake.crashNs;
+        }
+    }
+
+    // Async-signal-safe, called from the crash handler
+    bool promoteStandby(int sigNum) {
+        if (standbyFd < 0) return false;
+        StandbyWake wake{monotonicNs(), getpid(), sigNum};
+        bool sent = write(standbyFd, &wake, sizeof(wake)) == static_cast<ssize_t>(sizeof(wake));
+        close(standbyFd);
+        standbyFd = -1;
+        return sent;
+    }
+
+    // Rss/Pss/private memory of the standby in KiB; Pss is the honest share of the copy-on-write pages
+    bool readStandbyMemory(long long& rssKb, long long& pssKb, long long& privateKb) const {
+        rssKb = pssKb = privateKb = 0;
+        if (standbyPid <= 0) return false;
+        std::ifstream smaps("/proc/" + std::to_string(standbyPid) + "/smaps_rollup");
+        if (!smaps.is_open()) return false;
+        std::string line;
+        while (std::getline(smaps, line)) {
+            long long value = 0;
+            if (std::sscanf(line.c_str(), "Rss: %lld", &value) == 1) rssKb = value;
+            else if (std::sscanf(line.c_str(), "Pss: %lld", &value) == 1) pssKb = value;
+            else if (std::sscanf(line.c_str(), "Private_Clean: %lld", &value) == 1) privateKb += value;
+            else if (std::sscanf(line.c_str(), "Private_Dirty: %lld", &value) == 1) privateKb += value;
+        }
+        return true;
+    }
+
+    static constexpr const char* RESTART_ENV = CrashReportChannel::RESTART_ENV;
+    long long restartRequestedNs;
+    StateHandoff stateHandoff;
+
+    // The replacement keeps argv, environment and working directory; one posix_spawn (vfork + exec),
+    // descriptors above stderr closed in the child, and nothing to wait for afterwards.
+    static bool spawnReplacement(long long requestedNs, int handoffFd = -1) {
+        std::vector<std::string> args;
+        std::ifstream cmdline("/proc/self/cmdline", std::ios::binary);
+        for (std::string arg; std::getline(cmdline, arg, '\0'); ) args.push_back(arg);
+        if (args.empty()) args.emplace_back("/proc/self/exe");
+
+        std::vector<std::string> env;
+        std::string marker = std::string(RESTART_ENV) + "=";
+        std::string handoffMarker = std::string(StateHandoff::FD_ENV) + "=";
+        for (char** e = environ; e && *e; e++) {
+            if (std::strncmp(*e, marker.c_str(), marker.size()) != 0 &&
+                std::strncmp(*e, handoffMarker.c_str(), handoffMarker.size()) != 0) {
+                env.emplace_back(*e);
+            }
+        }
+        env.push_back(marker + std::to_string(requestedNs));
+        if (handoffFd >= 0) env.push_back(handoffMarker + "3");
+
+        std::vector<char*> argv, envp;
+        for (std::string& arg : args) argv.push_back(&arg[0]);
+        argv.push_back(nullptr);
+        for (std::string& var : env) envp.push_back(&var[0]);
+        envp.push_back(nullptr);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+        // the handoff memfd becomes fd 3 of the new instance, everything above it is closed
+        if (handoffFd >= 0) posix_spawn_file_actions_adddup2(&actions, handoffFd, 3);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+        posix_spawn_file_actions_addclosefrom_np(&actions, handoffFd >= 0 ? 4 : 3);
+#else
+        // no closefrom action: flag everything close-on-exec, this process is about to exit anyway
+        if (syscall(SYS_close_range, 3U, ~0U, 4U /* CLOSE_RANGE_CLOEXEC */) != 0) {
+            for (int fd = 3; fd < 1024; fd++) fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+#endif
+
+        // may run from inside the crash handler, where most signals are still blocked
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+        sigset_t all, none;
+        sigfillset(&all);
+        sigemptyset(&none);
+        posix_spawnattr_setsigdefault(&attr, &all);
+        posix_spawnattr_setsigmask(&attr, &none);
+
+        pid_t pid;
+        int rc = posix_spawn(&pid, "/proc/self/exe", &actions, &attr, argv.data(), envp.data());
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        COS_PROBE2(restart, rc == 0 ? pid : -1, requestedNs);
+        return rc == 0;
+    }
+
+    static void forwardToChild(int sigNum) {
+        if (supervisedChild > 0) kill(supervisedChild, sigNum);
+    }
+
+    // Tees both pipes to the console and the capture buffer until the child is gone
+    int pumpChild(pid_t child, int outFd, int errFd) {
+        int pidfd = openPidfd(child);
+        bool outOpen = true, errOpen = true, exited = false;
+        int status = 0;
+        char buffer[16384];
+
+        while (outOpen || errOpen || !exited) {
+            pollfd fds[3] = {{outOpen ? outFd : -1, POLLIN, 0},
+                             {errOpen ? errFd : -1, POLLIN, 0},
+                             {exited ? -1 : pidfd, POLLIN, 0}};
+            // without a pidfd fall back to polling waitpid every 100 ms
+            int rc = poll(fds, 3, pidfd < 0 && !exited ? 100 : (exited ? 200 : -1));
+            if (rc < 0 && errno != EINTR) break;
+            if (rc == 0 && exited) break;  // a grandchild still holds the pipe open
+
+            for (int i = 0; i < 2; i++) {
+                if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+                ssize_t n = read(fds[i].fd, buffer, sizeof(buffer));
+                if (n <= 0) {
+                    (i == 0 ? outOpen : errOpen) = false;
+                    continue;
+                }
+                capturedOutput.write(buffer, n);
+                const char* p = buffer;
+                while (n > 0) {
+                    ssize_t w = ::write(i == 0 ? STDOUT_FILENO : STDERR_FILENO, p, static_cast<size_t>(n));
+                    if (w <= 0) break;
+                    p += w;
+                    n -= w;
+                }
+            }
+
+            if (!exited && (pidfd < 0 || (fds[2].revents & POLLIN))) {
+                pid_t done = waitpid(child, &status, pidfd < 0 ? WNOHANG : 0);
+                exited = done == child || (done < 0 && errno == ECHILD);
+            }
+        }
+        if (pidfd >= 0) close(pidfd);
+        supervisedChild = 0;
+        return status;
+    }
+#endif
+
+#ifdef _WIN32
+    void setupSignalHandlers() {
+        std::signal(SIGTERM, signalHandler);
+        std::signal(SIGINT, signalHandler);
+        std::signal(SIGABRT, signalHandler);
+        std::signal(SIGFPE, signalHandler);
+        std::signal(SIGILL, signalHandler);
+        std::signal(SIGSEGV, signalHandler);
+    }
+
+    static void signalHandler(int sigNum) {
+        if (globalInstance) {
+            globalInstance->handleSignal(sigNum);
+        }
+    }
+#else
+    static constexpr size_t ALT_STACK_SIZE = 4 * 1024 * 1024;
+
+    void setupSignalHandlers() {
+        // a stack overflow leaves no room to run the handler, give it its own stack
+        void* mem = mmap(nullptr, ALT_STACK_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem != MAP_FAILED) {
+            altStack = static_cast<uint8_t*>(mem);
+            stack_t ss{};
+            ss.ss_sp = altStack;
+            ss.ss_size = ALT_STACK_SIZE;
+            sigaltstack(&ss, nullptr);
+        }
+
+        struct sigaction sa{};
+        sa.sa_sigaction = signalHandler;
+        sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&sa.sa_mask);
+        for (int sig : {SIGTERM, SIGINT, SIGABRT, SIGFPE, SIGILL, SIGSEGV, SIGBUS, SIGQUIT, SIGTRAP}) {
+            sigaction(sig, &sa, nullptr);
+        }
+
+        // backtrace() loads libgcc on first use, do it now rather than inside a handler
+        void* warmup[1];
+        backtrace(warmup, 1);
+
+        if (threadDumpSignal == 0) threadDumpSignal = SIGRTMIN + 3;
+        struct sigaction dump{};
+        dump.sa_sigaction = threadDumpHandler;
+        dump.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&dump.sa_mask);
+        sigaction(threadDumpSignal, &dump, nullptr);
+
+        if (diagnosticSignal != 0) {
+            struct sigaction diag{};
+            diag.sa_handler = diagnosticHandler;
+            diag.sa_flags = SA_RESTART;
+            sigemptyset(&diag.sa_mask);
+            sigaction(diagnosticSignal, &diag, nullptr);
+        }
+    }
+
+    static void signalHandler(int sigNum, siginfo_t* info, void* context) {
+        COS_PROBE2(signal_caught, sigNum, info ? info->si_code : 0);
+        if (!globalInstance) return;
+        if (sigNum == SIGTERM || sigNum == SIGINT) {
+            globalInstance->requestShutdown(sigNum);
+        } else {
+            globalInstance->handleSignal(sigNum, info, static_cast<ucontext_t*>(context));
+        }
+    }
+
+    static const char* getSignalCodeName(int sigNum, int code) {
+        switch (code) {
+        case SI_USER: return "SI_USER";
+        case SI_KERNEL: return "SI_KERNEL";
+        case SI_QUEUE: return "SI_QUEUE";
+        case SI_TKILL: return "SI_TKILL";
+        case SI_TIMER: return "SI_TIMER";
+        default: break;
+        }
+        if (sigNum == SIGSEGV) {
+            switch (code) {
+            case SEGV_MAPERR: return "SEGV_MAPERR";
+            case SEGV_ACCERR: return "SEGV_ACCERR";
+            default: break;
+            }
+        } else if (sigNum == SIGBUS) {
+            switch (code) {
+            case BUS_ADRALN: return "BUS_ADRALN";
+            case BUS_ADRERR: return "BUS_ADRERR";
+            case BUS_OBJERR: return "BUS_OBJERR";
+            default: break;
+            }
+        } else if (sigNum == SIGFPE) {
+            switch (code) {
+            case FPE_INTDIV: return "FPE_INTDIV";
+            case FPE_INTOVF: return "FPE_INTOVF";
+            case FPE_FLTDIV: return "FPE_FLTDIV";
+            case FPE_FLTOVF: return "FPE_FLTOVF";
+            case FPE_FLTUND: return "FPE_FLTUND";
+            case FPE_FLTRES: return "FPE_FLTRES";
+            case FPE_FLTINV: return "FPE_FLTINV";
+            case FPE_FLTSUB: return "FPE_FLTSUB";
+            default: break;
+            }
+        } else if (sigNum == SIGILL) {
+            switch (code) {
+            case ILL_ILLOPC: return "ILL_ILLOPC";
+            case ILL_ILLOPN: return "ILL_ILLOPN";
+            case ILL_ILLADR: return "ILL_ILLADR";
+            case ILL_ILLTRP: return "ILL_ILLTRP";
+            case ILL_PRVOPC: return "ILL_PRVOPC";
+            case ILL_PRVREG: return "ILL_PRVREG";
+            case ILL_COPROC: return "ILL_COPROC";
+            case ILL_BADSTK: return "ILL_BADSTK";
+            default: break;
+            }
+        }
+        return "UNKNOWN";
+    }
+
+    // First guess at what kind of fault this was, answered from si_code, si_addr and sp alone
+    static std::string describeFault(int sigNum, const siginfo_t& si, uintptr_t sp) {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(si.si_addr);
+        if (si.si_code <= 0) {
+            return "sent by pid " + std::to_string(si.si_pid);
+        }
+        if (sigNum == SIGSEGV || sigNum == SIGBUS) {
+            // general protection faults (non-canonical address, privileged access) carry no address
+            if (si.si_code == SI_KERNEL) return "general protection fault";
+            if (addr < 4096) return "null pointer dereference";
+            if (addr < sp + 4096 && addr + 1024 * 1024 > sp) return "stack overflow";
+            if (si.si_code == SEGV_ACCERR) return "access to protected memory";
+            return "wild pointer (address not mapped)";
+        }
+        if (sigNum == SIGFPE) {
+            return si.si_code == FPE_INTDIV ? "integer divide by zero" : "arithmetic fault";
         }
+        if (sigNum == SIGILL) return "illegal instruction";
+        return "";
     }
+#endif
 
     inline std::string getSignalName(int sigNum) const {
         switch(sigNum) {
@@ -221,27 +4864,112 @@ private:
         case SIGBUS: return "SIGBUS";
         case SIGQUIT: return "SIGQUIT";
         case SIGTRAP: return "SIGTRAP";
+        case SIGKILL: return "SIGKILL";
+        case SIGHUP: return "SIGHUP";
+        case SIGUSR1: return "SIGUSR1";
+        case SIGUSR2: return "SIGUSR2";
 #endif
         default: return "Signal " + std::to_string(sigNum);
         }
     }
 
+#ifdef _WIN32
     void handleSignal(int sigNum) {
+#else
+    void handleSignal(int sigNum, siginfo_t* si = nullptr, ucontext_t* uc = nullptr) {
+        // copy first, everything below may clobber the kernel-provided frame
+        hasCrashContext = si && uc;
+        if (hasCrashContext) {
+            crashSiginfo = *si;
+            crashContext = *uc;
+        } else {
+            std::memset(&crashSiginfo, 0, sizeof(crashSiginfo));
+            getcontext(&crashContext);
+        }
+        armWatchdog(sigNum);
+        crashing.store(true);
+        if (oomMode.load()) {
+            if (sigNum != SIGTERM && sigNum != SIGINT) recordCrash(sigNum);
+            promoteStandby(sigNum);
+            handleSignalWithoutHeap(sigNum);
+        }
+        bool failedOver = false;
+        if (sigNum != SIGTERM && sigNum != SIGINT) {
+            recordCrash(sigNum);
+            failedOver = promoteStandby(sigNum);
+        }
+        deferSymbols = true;
+#endif
         std::string signalName = getSignalName(sigNum);
         std::string currentTime = getTimestampForLog();
 
         std::cout << "\n!!! A " << signalName << " SIGNAL FAILURE CAUGHT !!!" << std::endl;
 
 #ifndef _WIN32
+        uintptr_t faultAddress = reinterpret_cast<uintptr_t>(crashSiginfo.si_addr);
+        uintptr_t pc = CrashSnapshot::programCounterOf(&crashContext);
+        uintptr_t sp = CrashSnapshot::stackPointerOf(&crashContext);
+        std::string faultDescription = describeFault(sigNum, crashSiginfo, sp);
+        uint64_t regs[64];
+        size_t regCount = CrashSnapshot::registersOf(&crashContext, regs, 64);
+
+        if (hasCrashContext) {
+            std::cout << "Fault: " << getSignalCodeName(sigNum, crashSiginfo.si_code);
+            if (crashSiginfo.si_code > 0) std::cout << " at 0x" << std::hex << faultAddress << std::dec;
+            std::cout << (faultDescription.empty() ? "" : " (" + faultDescription + ")") << "\n";
+            for (size_t i = 0; i < regCount; i++) {
+                std::cout << std::setw(8) << CrashSnapshot::registerName(i) << " 0x" << std::hex
+                          << std::setw(16) << std::setfill('0') << regs[i] << std::setfill(' ') << std::dec
+                          << ((i % 3 == 2 || i + 1 == regCount) ? "\n" : "  ");
+            }
+            std::cout.flush();
+        }
+
+        if (!uncaughtType.empty()) {
+            std::cout << "Uncaught exception: " << uncaughtType << (uncaughtWhat.empty() ? "" : ": " + uncaughtWhat) << "\n";
+            if (!throwSiteTrace.empty()) std::cout << "\n The Throw Site Trace; " << irs() << throwSiteTrace << irs();
+            std::cout.flush();
+        }
+
         stackTrace = captureStackTrace();
+        size_t traced = std::min(stackTrace.size(), WATCHDOG_TRACE_SIZE - 1);
+        std::memcpy(watchdogTrace, stackTrace.data(), traced);
+        watchdogTrace[traced] = '\0';
+        crashStage.store(StageTraced);
         if (!stackTrace.empty()) {
             std::cout << "\n The Crash Signal  Trace; " << irs() << stackTrace << irs() ;
         }
+
+        // a snapshot that does not finish in time keeps the thread state, the crash goes without it
+        if (diagnosticLock.try_lock_for(std::chrono::milliseconds(CRASH_SNAPSHOT_WAIT_MS))) captureAllThreads();
+        else std::cout << "Thread capture: skipped, a diagnostic snapshot is still running" << std::endl;
+        crashStage.store(StageThreads);
+        if (threadCount > 0) {
+            std::cout << "Thread capture: " << threadsCaptured << "/" << threadCount << " other threads in "
+                      << threadCaptureUs / 1000.0 << " ms" << std::endl;
+        }
+
+        snapshotSize = CrashSnapshot::write(snapshotPath.c_str(), snapshotLimit, sigNum, crashSiginfo.si_code,
+                                            crashSiginfo.si_addr, &crashContext, crashFrames, crashFrameCount);
+        crashStage.store(StageSnapshot);
+
+        if (failedOver) {
+            std::cout << "Failover: standby pid " << standbyPid << " promoted" << std::endl;
+        }
+        listPendingFrames();
 #endif
 
         saveLog("Crashed: " + signalName);
+#ifndef _WIN32
+        crashStage.store(StageSaved);
+        // the standby is already the running instance, no dialog offering a restart
+        if (failedOver) dieWithSignal(sigNum);
+        bool useReporter = !reporterPath.empty();
+#else
+        bool useReporter = false;
+#endif
 
-        if (crashCallback) {
+        if (crashCallback || useReporter) {
 
             auto endTimePoint = std::chrono::system_clock::now();
             auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -254,42 +4982,212 @@ private:
             info.stackTrace = stackTrace;
             info.timestamp = currentTime;
             info.logPath = logPath;
+#ifndef _WIN32
+            if (snapshotSize > 0) info.snapshotPath = snapshotPath;
+            if (hasCrashContext) {
+                info.signalCode = crashSiginfo.si_code;
+                info.signalCodeName = getSignalCodeName(sigNum, crashSiginfo.si_code);
+                info.faultDescription = faultDescription;
+                info.faultAddress = faultAddress;
+                info.programCounter = pc;
+                info.stackPointer = sp;
+                for (size_t i = 0; i < regCount; i++) {
+                    info.registers.emplace_back(CrashSnapshot::registerName(i), regs[i]);
+                }
+            }
+            info.exceptionType = uncaughtType;
+            info.exceptionWhat = uncaughtWhat;
+            info.throwSiteTrace = throwSiteTrace;
+            info.threadStacks = threadStacks;
+            info.threadCount = threadCount;
+            info.threadCaptureUs = threadCaptureUs;
+            info.metrics = metricsText;
+            info.resourceTrend = resourceTrend;
+            info.lockContention = lockContention;
+            for (size_t i = 0; i < crumbCount; i++) {
+                const Breadcrumbs::Crumb& crumb = crumbs[i];
+                info.breadcrumbs.push_back({crumb.category ? crumb.category : "", crumb.id, crumb.tid, crumb.a, crumb.b,
+                                            static_cast<long long>(crumbsTakenNs - crumb.ns) / 1000});
+            }
+            for (size_t i = 0; i < annotationCount; i++) {
+                info.annotations.emplace_back(annotations[i].key, annotations[i].value);
+            }
+#endif
             info.logContent = capturedOutput.str();
             info.executableName = executableName;
             info.startTime = startTime;
             info.sessionDurationMs = duration.count();
 
-            crashCallback(info);
+#ifndef _WIN32
+            if (useReporter) {
+                reportChannel.publish(info, info.logContent);
+                if (reportChannel.spawn(reporterPath, stateHandoff.seal())) {
+                    std::cerr << "COS: crash report handed to " << reporterPath << std::endl;
+                    dieWithSignal(sigNum);
+                }
+            }
+            crashStage.store(StageCallback);
+#endif
+            if (crashCallback) {
+                COS_PROBE1(crash_callback, sigNum);
+                crashCallback(info);
+            } else {
+                std::exit(sigNum);
+            }
         } else {
             std::exit(sigNum);
         }
     }
 
 public:
-    COS() : logSaved(false), crashCallback(nullptr), coutBuffer(nullptr), cerrBuffer(nullptr) {
+    // the streams' own buffers are known from the start: the supervisor saves logs before any tee exists
+    COS() : originalCoutBuffer(std::cout.rdbuf()), originalCerrBuffer(std::cerr.rdbuf()), logSaved(false),
+            crashCallback(nullptr), coutBuffer(nullptr), cerrBuffer(nullptr) {
         executableName = getExecutableNameInternal();
         logPath = getTempDir();
+#ifndef _WIN32
+        crashFrameCount = 0;
+        snapshotPath = logPath.substr(0, logPath.size() - 4) + ".cosdump";
+        snapshotLimit = 64 * 1024;
+        snapshotSize = 0;
+        hasCrashContext = false;
+        altStack = nullptr;
+        threadCaptureTimeoutMs = 200;
+        threadCount = threadsCaptured = 0;
+        threadCaptureUs = threadMaxPauseUs = 0;
+        diagnosticRequested = false;
+        crashing = false;
+        diagnosticCount = 0;
+        watchdogArmed = false;
+        watchdogStop = false;
+        crashStage = StageIdle;
+        crashSignal = 0;
+        crashTimeBudgetMs = 10000;
+        shutdownSignal = 0;
+        shutdownHookBudgetMs = 2000;
+        shutdownDrainMs = 500;
+        sem_init(&watchdogArm, 0, 0);
+        sem_init(&watchdogDone, 0, 0);
+        supervised = false;
+        standbyPid = 0;
+        standbyFd = -1;
+        standbyPromoted = false;
+        promotedFrom = 0;
+        restartRequestedNs = 0;
+        if (const char* restarted = std::getenv(RESTART_ENV)) {
+            restartRequestedNs = std::atoll(restarted);
+            unsetenv(RESTART_ENV);
+        }
+        stateHandoff.adopt();
+
+        crashHistoryPath = getCrashHistoryPathInternal();
+        recentCrashes = pruneCrashHistory();
+        safeMode = false;
+        long long loopDelayMs = crashLoopDelayMs(recentCrashes);
+        if (loopDelayMs > 0 && crashLoopSafeMode) {
+            // one reused log instead of a new file per crash, and no optional capture work
+            safeMode = true;
+            logPath = "/tmp/" + executableName + "_safemode.log";
+            snapshotPath = "/tmp/" + executableName + "_safemode.cosdump";
+            snapshotLimit = 16 * 1024;
+            threadCaptureTimeoutMs = 0;
+            debuginfod.setUrls("");
+        }
+        if (loopDelayMs > 0 && restartRequestedNs > 0) sleepMs(loopDelayMs);
+#endif
 
         startTimePoint = std::chrono::system_clock::now();
         startTime = getTimestampForLog();
 
+#ifndef _WIN32
+        if (supervisorEnabled() && superviseChild()) {
+            // the supervisor captures our output and notices any death, nothing to do in here
+            supervised = true;
+            logSaved = true;
+            globalInstance = this;
+            return;
+        }
+
+        if (preparedStandbyFd >= 0 || preparedWake.crashedPid != 0) adoptPreparedStandby();
+        else if (standbyEnabled()) keepStandby();
+
+        // the watchdog samples and dumps on these, so they are set before it starts
+        metricsPath = logPath.substr(0, logPath.size() - 4) + ".prom";
+        if (const char* interval = std::getenv("COS_METRICS_INTERVAL")) metricsIntervalMs = std::atoi(interval);
+        metricsDueNs = monotonicNs() + metricsIntervalMs * 1000000LL;
+        if (const char* interval = std::getenv("COS_RESOURCE_INTERVAL")) resourceIntervalMs = std::atoi(interval);
+        if (resourceIntervalMs > 0 && resources.open()) resources.sample();
+        resourceDueNs = monotonicNs() + resourceIntervalMs * 1000000LL;
+
+        try {
+            watchdogThread = std::thread([this]() { watchdogLoop(); });
+        } catch (const std::system_error&) {
+            std::cerr << "COS: watchdog thread unavailable, crash handling is unbounded" << std::endl;
+            try {
+                shutdownThread = std::thread([this]() { shutdownLoop(); });
+            } catch (const std::system_error&) {
+            }
+        }
+#endif
+
         originalCoutBuffer = std::cout.rdbuf();
-        coutBuffer = new TeeStreambuf(originalCoutBuffer, capturedOutput.rdbuf());
+        coutBuffer = new TeeStreambuf(originalCoutBuffer, capturedOutput.rdbuf(), &captureLock, 1);
         std::cout.rdbuf(coutBuffer);
 
         originalCerrBuffer = std::cerr.rdbuf();
-        cerrBuffer = new TeeStreambuf(originalCerrBuffer, capturedOutput.rdbuf());
+        cerrBuffer = new TeeStreambuf(originalCerrBuffer, capturedOutput.rdbuf(), &captureLock, 2);
         std::cerr.rdbuf(cerrBuffer);
 
         globalInstance = this;
         setupSignalHandlers();
+#ifndef _WIN32
+        // touched, or releasing it under memory pressure would give nothing back
+        if (emergencyReserveSize > 0 && !emergencyReserve) {
+            emergencyReserve = std::malloc(emergencyReserveSize);
+            if (emergencyReserve) std::memset(emergencyReserve, 0xA5, emergencyReserveSize);
+        }
+        previousNewHandler = std::set_new_handler(oomNewHandler);
+        previousTerminate = std::set_terminate(terminateHandler);
+        throwCaptureOn = true;
+
+        profileDumps = 0;
+        profileSamples = 0;
+        if (const char* rate = std::getenv("COS_PROFILE")) profilerRate = std::atoi(rate);
+        if (profilerRate > 0 && !safeMode) profiler.start(profilerRate, profilerCapacity);
+        if (const char* bytes = std::getenv("COS_HEAP_PROFILE")) heapSampleBytes = std::strtoull(bytes, nullptr, 10);
+        if (heapSampleBytes > 0 && !safeMode) HeapProfiler::start(heapSampleBytes);
+        if (const char* locks = std::getenv("COS_LOCK_PROFILE")) lockProfiling = std::atoi(locks) != 0;
+        if (lockProfiling && !safeMode) LockProfiler::start();
+        traceDumps = 0;
+        traceEvents = 0;
+        if (const char* events = std::getenv("COS_TRACE")) traceCapacity = std::strtoull(events, nullptr, 10);
+        if (traceCapacity > 0 && !safeMode) TraceRecorder::start(traceCapacity);
+        if (const char* marker = std::getenv("COS_TRACE_MARKER")) traceMarker = std::atoi(marker) != 0;
+        if (traceMarker && !TraceRecorder::mirrorToTraceMarker(true)) {
+            std::cerr << "COS: trace_marker not writable, scopes are not mirrored" << std::endl;
+        }
+#endif
 
         std::cout << "COS: " << logPath << std::endl;
+#ifndef _WIN32
+        if (loopDelayMs > 0) {
+            std::cout << "COS: crash loop detected, " << recentCrashes << " crashes in the last "
+                      << crashLoopWindowSec << " s" << (restartRequestedNs > 0 ? ", restart delayed by " +
+                      std::to_string(loopDelayMs) + " ms" : "") << (safeMode ? ", safe mode" : "") << std::endl;
+        }
+        if (standbyPromoted) {
+            std::cout << "COS: promoted from standby after pid " << promotedFrom << " crashed" << std::endl;
+        }
+        reportRestartLatency("started");
+#endif
     }
 
     ~COS() {
         if (!logSaved) {
             saveLog("Normal exit");
+#ifndef _WIN32
+            unlink(crashHistoryPath.c_str());
+#endif
         }
 
         std::cout.rdbuf(originalCoutBuffer);
@@ -298,6 +5196,38 @@ public:
         delete coutBuffer;
         delete cerrBuffer;
 
+#ifndef _WIN32
+        for (std::thread* thread : {&watchdogThread, &shutdownThread}) {
+            if (!thread->joinable()) continue;
+            watchdogStop = true;
+            sem_post(&watchdogArm);
+            sem_post(&watchdogDone);
+            if (thread->get_id() == std::this_thread::get_id()) {
+                thread->detach();
+            } else {
+                thread->join();
+            }
+        }
+        sem_destroy(&watchdogArm);
+        sem_destroy(&watchdogDone);
+        throwCaptureOn = false;
+        if (std::get_terminate() == terminateHandler) std::set_terminate(previousTerminate);
+        if (std::get_new_handler() == oomNewHandler) std::set_new_handler(previousNewHandler);
+        std::free(emergencyReserve);
+        emergencyReserve = nullptr;
+        // an idle standby exits as soon as its socket hangs up
+        if (standbyFd >= 0) close(standbyFd);
+
+        // Tri_term() deletes us from inside the handler, never unmap the stack we are running on
+        stack_t current{};
+        if (altStack && sigaltstack(nullptr, &current) == 0 && !(current.ss_flags & SS_ONSTACK)) {
+            stack_t disable{};
+            disable.ss_flags = SS_DISABLE;
+            sigaltstack(&disable, nullptr);
+            munmap(altStack, ALT_STACK_SIZE);
+        }
+#endif
+
         if (globalInstance == this) {
             globalInstance = nullptr;
         }
@@ -307,12 +5237,35 @@ public:
         crashCallback = callback;
     }
 
+    // After this nothing more is written into capturedOutput, it can be read without the lock
+    void stopCapture() {
+        bool locked = captureLock.try_lock_for(std::chrono::milliseconds(TeeStreambuf::CAPTURE_LOCK_WAIT_MS));
+        if (coutBuffer) coutBuffer->stopCapture();
+        if (cerrBuffer) cerrBuffer->stopCapture();
+        if (locked) captureLock.unlock();
+    }
+
     void saveLog(const std::string& exitReason) {
         if (logSaved) return;
-        logSaved = true;
+#ifndef _WIN32
+        if (oomMode.load()) {
+            saveLogRaw(exitReason.c_str(), false);
+            return;
+        }
+#endif
+        // the watchdog (shutdown, hang) and a crashing thread can both get here, only one writes
+        if (logSaved.exchange(true)) return;
+        COS_PROBE1(save_log_begin, exitReason.c_str());
+        auto saveBegan = std::chrono::steady_clock::now();
+#ifndef _WIN32
+        // before anything below has a chance to run long
+        crumbsTakenNs = static_cast<uint64_t>(monotonicNs());
+        crumbCount = Breadcrumbs::newest(crumbs, CRUMBS_IN_REPORT);
+        annotationCount = Annotations::snapshot(annotations, Annotations::CAPACITY);
+#endif
 
-        std::cout.rdbuf(originalCoutBuffer);
-        std::cerr.rdbuf(originalCerrBuffer);
+        // not swapping std::cout's buffer back: this may not be the thread that owns the streams
+        stopCapture();
 
         auto endTimePoint = std::chrono::system_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -329,132 +5282,643 @@ public:
         snprintf(durationBuffer, sizeof(durationBuffer), "%02lld:%02lld:%02lld:%02lld",
                  hours, minutes, seconds, centiseconds);
 
+#ifndef _WIN32
+        // the last samples before a crash are the interesting ones, stop before anything else runs
+        if (profiler.getSampleCount() > 0) {
+            profiler.stop();
+            profilePath = logPath.substr(0, logPath.size() - 4) + ".folded";
+            profileSamples = profiler.writeFolded(profilePath);
+        }
+        if (TraceRecorder::getEventCount() > 0) {
+            TraceRecorder::stop();
+            tracePath = logPath.substr(0, logPath.size() - 4) + ".trace.json";
+            traceEvents = TraceRecorder::writeChromeTrace(tracePath, logPath, startTime);
+        }
+        // one last point at the moment of exit or crash
+        if (resources.sample() || resources.getSampleCount() > 0) resourceTrend = resources.format(RESOURCE_LOG_SAMPLES);
+        if (LockProfiler::getContendedCount() > 0) lockContention = lockContentionReport(10);
+        if (Metrics::size() > 0) {
+            metricsText = Metrics::prometheusText(!crashing.load());
+            if (!metricsText.empty()) Metrics::writePrometheus(metricsPath, metricsText);
+        }
+#endif
+
         std::ofstream logFile(logPath);
         if (logFile.is_open()) {
             logFile << "--------------------------------------------- DATA ----------------------------------------------\n"
                     << "App: " << executableName << "\n"
                     << "Start: " << startTime << "\n"
                     << "Exit: " << exitReason << " at " << getTimestampForLog() << "\n"
-                    << "Duration: " << durationBuffer << " (HH:MM:SS:CS)\n\n"
+                    << "Duration: " << durationBuffer << " (HH:MM:SS:CS)\n";
+#ifndef _WIN32
+            if (snapshotSize > 0) {
+                logFile << "Snapshot: " << snapshotPath << " (" << snapshotSize << " bytes)\n";
+            }
+            if (profileSamples > 0) {
+                logFile << "Profile: " << profilePath << " (" << profileSamples << " samples at " << profiler.getRate()
+                        << " Hz per thread CPU, overhead " << profiler.overheadPercent() << "%)\n";
+            }
+            if (traceEvents > 0) {
+                logFile << "Trace: " << tracePath << " (" << traceEvents << " events from "
+                        << TraceRecorder::getThreadCount() << " threads)\n";
+            }
+            if (!metricsText.empty()) {
+                logFile << "Metrics: " << metricsPath << "\n";
+            }
+            long long rssKb, pssKb, privateKb;
+            if (standbyFd >= 0 && readStandbyMemory(rssKb, pssKb, privateKb)) {
+                logFile << "Standby: pid " << standbyPid << " (Rss " << rssKb << " KiB, Pss " << pssKb
+                        << " KiB, private " << privateKb << " KiB)\n";
+            }
+#endif
+            logFile << "\n"
                     << "----------------------------------------- CAPTURED LOGS -----------------------------------------\n"
                     << capturedOutput.str();
 
             if (!stackTrace.empty()) {
                 logFile  <<" THE SIGNAL FAULT STACK TRACE :" << irs() << stackTrace << irs();
             }
+#ifndef _WIN32
+            if (HeapProfiler::getSampleCount() > 0) {
+                logFile << heapProfileReport(10);
+            }
+            if (!lockContention.empty()) {
+                logFile << lockContention;
+            }
+            if (!metricsText.empty()) {
+                logFile << " METRICS :" << irs() << metricsText << irs();
+            }
+            if (!resourceTrend.empty()) {
+                logFile << " RESOURCES (" << resources.getSampleCount() << " samples every " << resourceIntervalMs
+                        << " ms, last " << RESOURCE_LOG_SAMPLES << " shown) :" << irs() << resourceTrend << irs();
+            }
+            if (annotationCount > 0) {
+                logFile << " ANNOTATIONS :" << irs() << formatAnnotations(annotations, annotationCount) << irs();
+            }
+            if (crumbCount > 0) {
+                logFile << " BREADCRUMBS (newest " << crumbCount << " of " << Breadcrumbs::getCount() << ") :" << irs()
+                        << formatBreadcrumbs(crumbs, crumbCount, crumbsTakenNs) << irs();
+            }
+            if (!throwSiteTrace.empty()) {
+                logFile << " THE THROW SITE (" << uncaughtType << ") :" << irs() << throwSiteTrace << irs();
+            }
+            if (!stackTrace.empty() && throwCount.load() > 0) {
+                logFile << " RECENT EXCEPTIONS (" << throwCount.load() << " thrown) :\n" << formatRecentThrows() << "\n";
+            }
+            if (!threadStacks.empty()) {
+                logFile << " OTHER THREADS (" << threadsCaptured << "/" << threadCount << " captured in "
+                        << threadCaptureUs / 1000.0 << " ms) :" << irs() << threadStacks << irs();
+            }
+            if (!pendingDebuginfo.empty()) {
+                logFile << PENDING_SECTION << " (cosec-reporter --resolve <log>) :" << irs() << pendingDebuginfo << irs();
+            }
+#endif
+            // the trailer can only time saveLog up to itself
+            saveLogUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - saveBegan).count();
+            logFile << formatStats();
 
             logFile.close();
         }
+        saveLogUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - saveBegan).count();
+        COS_PROBE1(save_log_end, exitReason.c_str());
+    }
+
+    // COS's own cost, for overhead budgets: what went through each stream and what it took
+    struct Stats {
+        struct Stream {
+            uint64_t bytes = 0;
+            uint64_t lines = 0;
+            uint64_t writes = 0;
+            uint64_t dropped = 0;
+            uint64_t consoleBlockedNs = 0;
+            uint64_t consoleMaxNs = 0;
+            uint64_t flushes = 0;
+            uint64_t flushP50Ns = 0;
+            uint64_t flushP99Ns = 0;
+            uint64_t flushMaxNs = 0;
+        };
+        Stream out;
+        Stream err;
+        uint64_t captureBufferBytes = 0;
+        long long saveLogUs = 0;
+    };
+
+    Stats getStats() const {
+        Stats stats;
+        auto fill = [](const TeeStreambuf* buffer, Stats::Stream& stream) {
+            if (!buffer) return;
+            const TeeStreambuf::Counters& c = buffer->getCounters();
+            stream.bytes = c.bytes.load();
+            stream.lines = c.lines.load();
+            stream.writes = c.writes.load();
+            stream.dropped = c.dropped.load();
+            stream.consoleBlockedNs = c.consoleNs.load();
+            stream.consoleMaxNs = c.consoleMaxNs.load();
+            stream.flushes = c.flushes.load();
+            // bucket upper bounds, so within 2x and never under
+            uint64_t seen = 0;
+            for (int i = 0; i < TeeStreambuf::FLUSH_BUCKETS; i++) {
+                uint64_t n = c.flushBuckets[i].load();
+                if (n == 0) continue;
+                uint64_t high = (1ULL << i) - 1;
+                if (stream.flushP50Ns == 0 && (seen + n) * 2 >= stream.flushes) stream.flushP50Ns = high;
+                if (stream.flushP99Ns == 0 && (seen + n) * 100 >= stream.flushes * 99) stream.flushP99Ns = high;
+                stream.flushMaxNs = high;
+                seen += n;
+            }
+        };
+        fill(coutBuffer, stats.out);
+        fill(cerrBuffer, stats.err);
+        std::streamoff captured;
+        {
+            std::lock_guard<std::timed_mutex> guard(captureLock);
+            captured = capturedOutput.rdbuf()->pubseekoff(0, std::ios::cur, std::ios::out);
+        }
+        stats.captureBufferBytes = captured > 0 ? static_cast<uint64_t>(captured) : 0;
+#ifndef _WIN32
+        if (oomCaptured > 0) {
+            stats.captureBufferBytes += OOM_CAPTURE_SIZE;
+            if (oomCaptured > OOM_CAPTURE_SIZE) stats.out.dropped += oomCaptured - OOM_CAPTURE_SIZE;
+        }
+#endif
+        stats.saveLogUs = saveLogUs;
+        return stats;
+    }
+
+    std::string formatStats() const {
+        Stats stats = getStats();
+        std::stringstream ss;
+        ss << " COS STATS :" << irs();
+        auto line = [&](const char* name, const Stats::Stream& s) {
+            ss << name << ": " << s.bytes << " bytes, " << s.lines << " lines in " << s.writes << " writes, "
+               << s.dropped << " dropped; console blocked " << s.consoleBlockedNs / 1e6 << " ms (max "
+               << s.consoleMaxNs / 1e6 << " ms); " << s.flushes << " flushes (p50 < " << s.flushP50Ns / 1e3
+               << " us, p99 < " << s.flushP99Ns / 1e3 << " us, max < " << s.flushMaxNs / 1e3 << " us)\n";
+        };
+        line("stdout", stats.out);
+        line("stderr", stats.err);
+        ss << "capture buffer: " << stats.captureBufferBytes << " bytes (peak, it only grows)\n"
+           << "saveLog: " << stats.saveLogUs / 1e3 << " ms" << irs();
+        return ss.str();
     }
 
     inline const std::string& getExecutableName() const { return executableName; }
     inline const std::string& getLogPath() const { return logPath; }
     inline const std::string& getStartTime() const { return startTime; }
     inline const std::string& getStackTrace() const { return stackTrace; }
-    inline std::string getLogContent() const { return capturedOutput.str(); }
+    inline std::string getLogContent() const {
+        std::lock_guard<std::timed_mutex> guard(captureLock);
+        return capturedOutput.str();
+    }
+#ifndef _WIN32
+    inline COSDebuginfod& getDebuginfod() { return debuginfod; }
 
-    static void Tri_reset() {
-        if (globalInstance) {
-            globalInstance->saveLog("Application restart initiated");
+    static constexpr const char* PENDING_SECTION = " DEBUGINFO PENDING";
+
+    // Out of process, after the crash: fetches what the log's pending section lists and appends the
+    // resolved frames to it. Returns how many resolved, -1 when the log has nothing pending.
+    static int resolvePendingFrames(const std::string& logPath) {
+        std::ifstream in(logPath, std::ios::binary);
+        std::string log((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        size_t header = log.find(PENDING_SECTION);
+        size_t begin = header == std::string::npos ? header : log.find(irs(), header);
+        size_t end = begin == std::string::npos ? begin : log.find(irs(), begin + irs().size());
+        if (end == std::string::npos) return -1;
+
+        std::istringstream section(log.substr(begin + irs().size(), end - begin - irs().size()));
+        COSDebuginfod debuginfod;
+        std::string list;
+        for (std::string line; std::getline(section, line); ) {
+            if (line.compare(0, 9, "servers: ") == 0) debuginfod.setUrls(line.substr(9));
+            else if (line.compare(0, 7, "cache: ") == 0) debuginfod.setCacheDir(line.substr(7));
+            else list += line + "\n";
         }
+        auto began = std::chrono::steady_clock::now();
+        size_t fetched = 0;
+        std::string resolved = debuginfod.resolvePending(list, &fetched);
+        long long fetchMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - began).count();
+        int count = static_cast<int>(std::count(resolved.begin(), resolved.end(), '\n'));
 
-#ifdef _WIN32
+        std::ofstream out(logPath, std::ios::app);
+        out << " DEBUGINFO RESOLVED (" << count << " frames, " << fetched << " debuginfo fetched in " << fetchMs
+            << " ms, pid " << getpid() << ") :" << irs() << resolved << irs();
+        return count;
+    }
+    inline const std::string& getSnapshotPath() const { return snapshotPath; }
+    inline void setSnapshotLimit(size_t bytes) { snapshotLimit = bytes; }
+    // 0 turns all-thread capture off; the signal must be set before COS is constructed
+    inline void setThreadCaptureTimeout(int ms) { threadCaptureTimeoutMs = ms; }
+    inline static void setThreadDumpSignal(int sig) { threadDumpSignal = sig; }
 
-        char exePath[MAX_PATH];
-        GetModuleFileNameA(NULL, exePath, MAX_PATH);
+    // Only the thread that constructs COS gets an alternate signal stack automatically; a stack overflow
+    // on any other thread is only reported if that thread called this first. Freed when the thread exits.
+    static bool protectThread() {
+        struct ThreadAltStack {
+            void* mem = nullptr;
+            ~ThreadAltStack() {
+                stack_t current{};
+                if (!mem || sigaltstack(nullptr, &current) != 0 || (current.ss_flags & SS_ONSTACK)) return;
+                stack_t disable{};
+                disable.ss_flags = SS_DISABLE;
+                sigaltstack(&disable, nullptr);
+                munmap(mem, ALT_STACK_SIZE);
+            }
+        };
+        thread_local ThreadAltStack altStack;
 
-        STARTUPINFOA si = { sizeof(si) };
-        PROCESS_INFORMATION pi;
+        stack_t current{};
+        if (sigaltstack(nullptr, &current) == 0 && !(current.ss_flags & SS_DISABLE)) return true;
+        void* mem = mmap(nullptr, ALT_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED) return false;
+        stack_t ss{};
+        ss.ss_sp = mem;
+        ss.ss_size = ALT_STACK_SIZE;
+        if (sigaltstack(&ss, nullptr) != 0) {
+            munmap(mem, ALT_STACK_SIZE);
+            return false;
+        }
+        altStack.mem = mem;
+        return true;
+    }
+    // Size of the block released on the first allocation failure, before COS is constructed; 0 disables it
+    inline static void setEmergencyReserve(size_t bytes) { emergencyReserveSize = bytes; }
+    inline static bool isOutOfMemory() { return oomMode.load(); }
 
-        if (CreateProcessA(
-                exePath,
+    // Stack for one throw in every `stackEvery` (default 64, 0: type and what() only); the ring keeps the last 16 throws
+    inline static void setThrowCapture(int stackEvery) { throwStackEvery = stackEvery; }
+    inline static unsigned long long getThrowCount() { return throwCount.load(); }
 
-                NULL,
+    // Called by the COS_THROW_HOOK __cxa_throw for every throw, on the throwing thread
+    __attribute__((noinline)) static void noteThrow(void* object, std::type_info* type) {
+        if (!throwCaptureOn.load(std::memory_order_relaxed)) return;
+        unsigned long long n = throwCount.fetch_add(1, std::memory_order_relaxed);
+        ThrowRecord& slot = throwRing[n % THROW_RING];
+        slot.seq.fetch_add(1, std::memory_order_acq_rel);
+        slot.type = type;
+        static thread_local pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+        slot.tid = tid;
+        slot.ns = monotonicNs();
+        slot.what[0] = '\0';
+#ifdef __GLIBCXX__
+        void* adjusted = object;
+        // the same test a `catch (const std::exception&)` would make; libstdc++ only
+        if (typeid(std::exception).__do_catch(type, &adjusted, 1)) {
+            std::strncpy(slot.what, static_cast<std::exception*>(adjusted)->what(), sizeof(slot.what) - 1);
+            slot.what[sizeof(slot.what) - 1] = '\0';
+        }
+#else
+        (void)object;
+#endif
+        slot.frameCount = 0;
+        if (throwStackEvery > 0 && n % static_cast<unsigned>(throwStackEvery) == 0) {
+            // drop noteThrow and __cxa_throw, start at the throw expression
+            void* frames[THROW_FRAMES + 2];
+            int count = backtrace(frames, THROW_FRAMES + 2);
+            slot.frameCount = count > 2 ? count - 2 : 0;
+            std::memcpy(slot.frames, frames + 2, sizeof(void*) * slot.frameCount);
+        }
+        slot.seq.fetch_add(1, std::memory_order_release);
+    }
 
-                NULL,
+    // Called by the COS_OOM_NEW operator new before the new_handler runs
+    inline static void noteFailedAllocation(size_t size) { oomRequestedSize.store(size); }
 
-                NULL,
+    // Opt-in CPU profiler from startup (or COS_PROFILE=<hz>); must be called before COS is constructed
+    inline static void enableProfiler(int hz = 99, size_t samples = 8192) {
+        profilerRate = hz;
+        profilerCapacity = samples;
+    }
 
-                FALSE,
+    inline bool startProfiler(int hz = 99) { return profiler.start(hz, profilerCapacity); }
+    inline void stopProfiler() { profiler.stop(); }
+    inline bool isProfiling() const { return profiler.isRunning(); }
 
-                DETACHED_PROCESS | CREATE_NEW_PROCESS_GROUP,
+    // Folded stacks of the samples in the ring so far, next to the log; empty if there are none
+    std::string writeProfile() {
+        std::string path = logPath.substr(0, logPath.size() - 4) + "_profile" + std::to_string(++profileDumps) + ".folded";
+        return profiler.writeFolded(path) > 0 ? path : "";
+    }
 
-                NULL,
+    // Opt-in COS_SCOPE / COS_TRACE_COUNTER recording from startup (or COS_TRACE=<events per thread>);
+    // must be called before COS is constructed. The timeline is written as <log>.trace.json on exit or crash.
+    // Up to 256 threads record at once; past that, a new thread takes over the ring of one that exited.
+    inline static void enableTrace(size_t eventsPerThread = 1 << 16) { traceCapacity = eventsPerThread; }
 
-                NULL,
+    // Also mirror trace events to /sys/kernel/tracing/trace_marker (or COS_TRACE_MARKER=1); needs write access
+    inline static void enableTraceMarker(bool on = true) { traceMarker = on; }
 
-                &si,
+    inline bool startTrace(size_t eventsPerThread = 1 << 16) { return TraceRecorder::start(eventsPerThread); }
+    inline void stopTrace() { TraceRecorder::stop(); }
+    inline bool isTracing() const { return TraceRecorder::isRecording(); }
 
-                &pi
+    // Chrome trace JSON of the events recorded so far, next to the log; empty if there are none
+    std::string writeTrace() {
+        std::string path = logPath.substr(0, logPath.size() - 4) + "_trace" + std::to_string(++traceDumps) + ".json";
+        return TraceRecorder::writeChromeTrace(path, logPath, startTime) > 0 ? path : "";
+    }
 
-                )) {
+    // Registered once by name (again returns the same handle), then updated lock-free from any thread
+    inline static Metrics::Counter counter(const std::string& name, const std::string& help = "") {
+        return Metrics::counter(name, help);
+    }
+    inline static Metrics::Gauge gauge(const std::string& name, const std::string& help = "") {
+        return Metrics::gauge(name, help);
+    }
+    inline static Metrics::Histogram histogram(const std::string& name, const std::string& help = "") {
+        return Metrics::histogram(name, help);
+    }
 
-            CloseHandle(pi.hProcess);
-            CloseHandle(pi.hThread);
+    // Resource sampling period (or COS_RESOURCE_INTERVAL=<ms>), 0 to turn it off; must be set before COS is constructed
+    inline static void setResourceInterval(int ms) { resourceIntervalMs = ms; }
 
-            Sleep(100);
-        } else {
-            if (globalInstance) {
-                globalInstance->saveLog("Failed to restart application");
-            }
+    // The sampled time series, oldest first; the whole ring unless limited
+    inline std::string getResourceTrend(size_t samples = SIZE_MAX) const { return resources.format(samples); }
+
+    // How often <log>.prom is rewritten (or COS_METRICS_INTERVAL=<ms>); 0 leaves it to exit and crash
+    inline static void setMetricsInterval(int ms) { metricsIntervalMs = ms; }
+
+    // Prometheus text of every metric right now, also written to <log>.prom
+    std::string writeMetrics() {
+        std::string text = Metrics::prometheusText();
+        Metrics::writePrometheus(metricsPath, text);
+        return text;
+    }
+
+    // Opt-in heap sampling, one sample per `sampleBytes` allocated on average (or COS_HEAP_PROFILE=<bytes>).
+    // Needs the COS_HEAP_INTERPOSE allocation wrappers; must be called before COS is constructed.
+    inline static void enableHeapProfiler(size_t sampleBytes = 512 * 1024) { heapSampleBytes = sampleBytes; }
+
+    // Cheap crash context: a category literal, an id and two numbers, no text formatting until a crash
+    inline static void breadcrumb(const char* category, uint32_t id, int64_t a = 0, int64_t b = 0) {
+        Breadcrumbs::record(category, id, a, b);
+    }
+
+    // Live state for the crash report, replaced in place; cheap enough to call per request.
+    // False when the update was dropped (see Annotations::set); keys are under Annotations::KEY_SIZE bytes.
+    inline static bool annotate(const char* key, std::string_view value) {
+        return Annotations::set(key, value.data(), value.size());
+    }
+
+    inline static bool annotate(const char* key, long long value) {
+        char text[24];
+        char* end = text + sizeof(text);
+        char* p = end;
+        unsigned long long magnitude = value < 0 ? 0ULL - static_cast<unsigned long long>(value) : value;
+        do {
+            *--p = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude);
+        if (value < 0) *--p = '-';
+        return Annotations::set(key, p, static_cast<size_t>(end - p));
+    }
+
+    inline static bool clearAnnotation(const char* key) { return Annotations::clear(key); }
+
+    static std::string formatAnnotations(const Annotations::Entry* entries, size_t count) {
+        std::ostringstream out;
+        for (size_t i = 0; i < count; i++) out << entries[i].key << " = " << entries[i].value << "\n";
+        return out.str();
+    }
+
+    static std::string formatBreadcrumbs(const Breadcrumbs::Crumb* crumbs, size_t count, uint64_t nowNs) {
+        std::ostringstream out;
+        char line[160];
+        for (size_t i = 0; i < count; i++) {
+            const Breadcrumbs::Crumb& crumb = crumbs[i];
+            snprintf(line, sizeof(line), "%12.3f ms  %-7d %-20s %10u %14lld %14lld\n",
+                     -static_cast<double>(nowNs - crumb.ns) / 1e6, crumb.tid, crumb.category ? crumb.category : "?",
+                     crumb.id, static_cast<long long>(crumb.a), static_cast<long long>(crumb.b));
+            out << line;
         }
+        return out.str();
+    }
 
-#else
+    // Top allocation sites by estimated live bytes
+    std::string heapProfileReport(size_t top = 10) const {
+        std::stringstream ss;
+        int64_t liveTotal = 0;
+        std::vector<HeapProfiler::SiteStats> sites = HeapProfiler::topSites(top, liveTotal);
+        ss << " HEAP PROFILE (1 sample per " << HeapProfiler::getSampleBytes() / 1024 << " KiB, "
+           << HeapProfiler::getSampleCount() << " samples";
+        if (HeapProfiler::getDroppedCount() > 0) ss << ", " << HeapProfiler::getDroppedCount() << " dropped";
+        ss << ", " << HeapProfiler::getSampleNs() / 1e6 << " ms sampling, ~" << liveTotal / 1024 << " KiB live) :";
+        if (!HeapProfiler::interposed) ss << "\n  allocation wrappers not built in (COS_HEAP_INTERPOSE)\n";
+        ss << irs();
+        for (size_t i = 0; i < sites.size(); i++) {
+            const HeapProfiler::SiteStats& site = sites[i];
+            ss << "#" << i + 1 << "  " << site.liveBytes / 1024 << " KiB live in ~" << site.liveCount
+               << " blocks, " << site.totalBytes / 1024 << " KiB in ~" << site.totalCount << " allocated overall\n"
+               << formatFrames(site.frames, std::min(site.depth, 8)) << "\n";
+        }
+        ss << irs();
+        return ss.str();
+    }
 
-        pid_t pid = fork();
+    // Writes the top sites into the captured log now
+    inline void logHeapProfile(size_t top = 10) { std::cout << heapProfileReport(top) << std::flush; }
 
-        if (pid == 0) {
+    // Opt-in contention profiling of pthread mutexes (std::mutex included), or COS_LOCK_PROFILE=1.
+    // Needs the COS_MUTEX_INTERPOSE wrapper; must be called before COS is constructed.
+    inline static void enableLockProfiler(bool on = true) { lockProfiling = on; }
 
-            setsid();
+    // Call sites by total time spent waiting for a contended mutex
+    std::string lockContentionReport(size_t top = 10) const {
+        std::stringstream ss;
+        std::vector<LockProfiler::SiteStats> sites = LockProfiler::topSites(top);
+        ss << " LOCK CONTENTION (" << LockProfiler::getContendedCount() << " contended acquisitions, "
+           << LockProfiler::getTotalWaitNs() / 1e6 << " ms waited";
+        if (LockProfiler::getDroppedCount() > 0) ss << ", " << LockProfiler::getDroppedCount() << " not attributed";
+        ss << ") :";
+        if (!LockProfiler::interposed) ss << "\n  pthread_mutex_lock wrapper not built in (COS_MUTEX_INTERPOSE)\n";
+        ss << irs();
+        for (size_t i = 0; i < sites.size(); i++) {
+            const LockProfiler::SiteStats& site = sites[i];
+            ss << "#" << i + 1 << "  " << site.waitNs / 1e6 << " ms waited in " << site.contentions
+               << " acquisitions (max " << site.maxWaitNs / 1e6 << " ms), mutex " << site.mutex << "\n"
+               << formatFrames(site.frames, std::min(site.depth, 8)) << "\n";
+        }
+        ss << irs();
+        return ss.str();
+    }
 
-            pid_t pid2 = fork();
-            if (pid2 > 0) {
+    inline void logLockContention(size_t top = 10) { std::cout << lockContentionReport(top) << std::flush; }
 
-                _exit(0);
-            } else if (pid2 == 0) {
+    // Signal that writes a live diagnostic snapshot (SIGUSR1 by default), 0 leaves it alone; before COS is constructed
+    inline static void setDiagnosticSignal(int sig) { diagnosticSignal = sig; }
 
-                chdir("/");
+    // Log tail, every thread's stack and COS counters to a file next to the log, the process keeps running
+    inline std::string takeDiagnosticSnapshot() { return writeDiagnosticSnapshot("API"); }
+    inline const std::string& getLastDiagnosticPath() const { return lastDiagnosticPath; }
 
-                close(STDIN_FILENO);
-                close(STDOUT_FILENO);
-                close(STDERR_FILENO);
+    // Hard limit on signal-to-exit time while crashing, 0 disables the watchdog
+    inline void setCrashTimeBudget(int ms) { crashTimeBudgetMs = ms; }
 
-                open("/dev/null", O_RDONLY);
+    // Run on SIGTERM/SIGINT, all at once, each on its own thread; the process exits after budgetMs either way
+    inline void addShutdownHook(const std::string& name, std::function<void()> hook) {
+        std::lock_guard<std::mutex> guard(shutdownHooksLock);
+        shutdownHooks.emplace_back(name, std::move(hook));
+    }
 
-                open("/dev/null", O_WRONLY);
+    inline void setShutdownBudget(int hookBudgetMs, int drainDeadlineMs) {
+        shutdownHookBudgetMs = hookBudgetMs;
+        shutdownDrainMs = drainDeadlineMs;
+    }
 
-                open("/dev/null", O_WRONLY);
+    // Opt-in supervisor mode, must be called before COS is constructed (or set COS_SUPERVISE=1 / =restart)
+    inline static void enableSupervisor(bool restartOnCrash = false, int maxRestarts = 3) {
+        supervisorRequested = true;
+        supervisorRestart = restartOnCrash;
+        supervisorMaxRestarts = maxRestarts;
+    }
 
-                for (int fd = 3; fd < 1024; fd++) {
-                    close(fd);
-                }
+    inline bool isSupervised() const { return supervised; }
 
-                execl("/proc/self/exe", "/proc/self/exe", (char*)NULL);
+    // Opt-in warm standby, must be called before COS is constructed (or set COS_STANDBY=1)
+    inline static void enableStandby() { standbyRequested = true; }
 
-                _exit(127);
-            } else {
+    // Warm standby for apps that construct COS after threads exist (Qt: after QApplication). Call first
+    // thing in main(); a promoted standby returns from here a second time and runs main() on from there.
+    static void prepareStandby() {
+        standbyRequested = true;
+        if (preparedStandbyFd >= 0) return;
+        if (threadsRunning() > 1) {
+            std::cerr << "COS: prepareStandby() must run before any thread is started" << std::endl;
+            return;
+        }
+        while (true) {
+            StandbyWake wake{};
+            if (forkStandby(preparedStandbyPid, preparedStandbyFd, wake) != StandbyPromoted) return;
+            preparedWake = wake;
+            // crashing in a loop: keep this instance, but stop burning standbys
+            if (promotionLoop()) return;
+        }
+    }
 
-                _exit(1);
-            }
-        } else if (pid > 0) {
+    inline pid_t getStandbyPid() const { return standbyFd >= 0 ? standbyPid : 0; }
+    inline bool isPromotedStandby() const { return standbyPromoted; }
+
+    inline bool getStandbyMemory(long long& rssKb, long long& pssKb, long long& privateKb) const {
+        return standbyFd >= 0 && readStandbyMemory(rssKb, pssKb, privateKb);
+    }
+
+    // Must be set before COS is constructed; threshold 0 turns crash-loop detection off
+    inline static void setCrashLoopPolicy(int threshold, int windowSec, int baseDelayMs = 1000,
+                                          int maxDelayMs = 30000, bool safeModeOnLoop = false) {
+        crashLoopThreshold = threshold;
+        crashLoopWindowSec = windowSec;
+        crashLoopBaseDelayMs = baseDelayMs;
+        crashLoopMaxDelayMs = maxDelayMs;
+        crashLoopSafeMode = safeModeOnLoop;
+    }
+
+    inline bool isSafeMode() const { return safeMode; }
+    inline int getRecentCrashCount() const { return recentCrashes; }
+    inline const std::string& getCrashHistoryPath() const { return crashHistoryPath; }
+
+    // State for the next instance after Tri_reset() or a reporter restart. Copied at the call, not at
+    // the crash: put again whenever the state changes, the next instance gets the last value put
+    inline bool putHandoffState(const std::string& name, const void* data, size_t size) {
+        return stateHandoff.put(name, data, size);
+    }
+
+    // State left by the previous instance, mapped read-only; valid until releaseHandoffState()
+    inline const void* getHandoffState(const std::string& name, size_t* size = nullptr) const {
+        return stateHandoff.get(name, size);
+    }
+
+    inline std::vector<std::string> getHandoffStateNames() const { return stateHandoff.names(); }
+    inline void releaseHandoffState() { stateHandoff.release(); }
+
+    // Crash reports go to this executable (see cosec-reporter) instead of the in-process callback.
+    // Returns false, leaving the callback in charge, when it is missing or the channel cannot be set up.
+    bool setCrashReporter(const std::string& path) {
+        if (path.empty() || access(path.c_str(), X_OK) != 0 ||
+            !reportChannel.open(executableName, startTime, logPath, snapshotPath)) {
+            reporterPath.clear();
+            return false;
+        }
+        reporterPath = path;
+        return true;
+    }
+
+    inline void setReporterWindow(const std::string& title, const std::string& iconName) {
+        reportChannel.setWindow(title, iconName);
+    }
+
+    // Call once the crash UI is actually on screen; from then on the user decides when to exit
+    inline void disarmWatchdog() {
+        if (watchdogArmed.exchange(false)) sem_post(&watchdogDone);
+    }
+#endif
+
+    static void Tri_reset() {
+        long long requestedNs = monotonicNs();
+        if (globalInstance) {
+            globalInstance->saveLog("Application restart initiated");
+        }
+
+#ifdef _WIN32
+
+        char exePath[MAX_PATH];
+        GetModuleFileNameA(NULL, exePath, MAX_PATH);
 
-            waitpid(pid, NULL, 0);
+        // same command line as this instance, CreateProcessA wants it writable
+        std::string commandLine = GetCommandLineA();
+        std::vector<char> commandBuffer(commandLine.begin(), commandLine.end());
+        commandBuffer.push_back('\0');
 
-            usleep(100000);
+        STARTUPINFOA si = { sizeof(si) };
+        PROCESS_INFORMATION pi;
 
+        if (CreateProcessA(exePath, commandBuffer.data(), NULL, NULL, FALSE,
+                           DETACHED_PROCESS | CREATE_NEW_PROCESS_GROUP, NULL, NULL, &si, &pi)) {
+            CloseHandle(pi.hProcess);
+            CloseHandle(pi.hThread);
         } else {
+            if (globalInstance) {
+                globalInstance->saveLog("Failed to restart application");
+            }
+        }
+
+#else
 
+        int handoffFd = globalInstance ? globalInstance->stateHandoff.seal() : -1;
+        if (!spawnReplacement(requestedNs, handoffFd)) {
             if (globalInstance) {
-                globalInstance->saveLog("Failed to fork for restart");
+                globalInstance->saveLog("Failed to spawn for restart");
             }
         }
 #endif
+        (void)requestedNs;
 
         Tri_term();
         exit(0);
 
     }
 
+    static long long monotonicNs() {
+#ifdef _WIN32
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<long long>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+#endif
+    }
+
+#ifndef _WIN32
+    // Logs how long ago Tri_reset() was clicked in the previous instance; no-op if this start was not a restart
+    void reportRestartLatency(const std::string& milestone) {
+        if (restartRequestedNs <= 0) return;
+        std::cout << "COS: " << milestone << " " << (monotonicNs() - restartRequestedNs) / 1e6
+                  << " ms after restart was requested" << std::endl;
+    }
+#endif
+
     static void Tri_term() {
 
         signal(SIGTERM, SIG_DFL);
@@ -486,4 +5950,96 @@ public:
 };
 
 
+#if defined(COS_OOM_NEW) && !defined(_WIN32)
+// Replacement operator new that tells COS the size of a failed request. Define COS_OOM_NEW in exactly
+// one translation unit of the program (libcrash is built with it).
+void* operator new(std::size_t size) {
+    if (size == 0) size = 1;
+    while (true) {
+        if (void* p = std::malloc(size)) return p;
+        COS::noteFailedAllocation(size);
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+#endif
+
+#if defined(COS_HEAP_INTERPOSE) && !defined(_WIN32) && defined(__GLIBC__)
+// malloc/calloc/realloc/free wrappers over glibc's own entry points for the heap profiler. Idle, each
+// is a flag check and a tail call (free: a filter byte once the profiler has run); cos-heap-bench
+// measures it. Define COS_HEAP_INTERPOSE in exactly one translation unit of the program.
+extern "C" {
+void* __libc_malloc(size_t size) noexcept;
+void* __libc_calloc(size_t count, size_t size) noexcept;
+void* __libc_realloc(void* ptr, size_t size) noexcept;
+void __libc_free(void* ptr) noexcept;
+
+// No wrapper is inlined or tail-calls allocated() when sampling: each keeps its frame, so the frames
+// sample() drops are the same whichever entry point the caller went through
+#define COS_KEEP_FRAME(p) asm volatile("" : : "r"(p) : "memory")
+
+__attribute__((noinline)) void* malloc(size_t size) noexcept {
+    if (!HeapProfiler::isSampling()) return __libc_malloc(size);
+    void* p = HeapProfiler::allocated(__libc_malloc(size), size);
+    COS_KEEP_FRAME(p);
+    return p;
+}
+
+__attribute__((noinline)) void* calloc(size_t count, size_t size) noexcept {
+    if (!HeapProfiler::isSampling()) return __libc_calloc(count, size);
+    void* p = HeapProfiler::allocated(__libc_calloc(count, size), count * size);
+    COS_KEEP_FRAME(p);
+    return p;
+}
+
+__attribute__((noinline)) void* realloc(void* ptr, size_t size) noexcept {
+    if (!HeapProfiler::isTracking()) return __libc_realloc(ptr, size);
+    void* p = __libc_realloc(ptr, size);
+    if (p || size == 0) HeapProfiler::onFree(ptr);
+    p = HeapProfiler::allocated(p, size);
+    COS_KEEP_FRAME(p);
+    return p;
+}
+
+void free(void* ptr) noexcept {
+    HeapProfiler::onFree(ptr);
+    __libc_free(ptr);
+}
+}
+
+#undef COS_KEEP_FRAME
+
+static const bool cosHeapInterposed = (HeapProfiler::interposed = true);
+#endif
+
+#if defined(COS_MUTEX_INTERPOSE) && !defined(_WIN32) && defined(__GLIBC__)
+// pthread_mutex_lock wrapper for the lock profiler: an uncontended lock is a trylock that succeeds.
+// Define COS_MUTEX_INTERPOSE in exactly one translation unit of the program (libcrash: -DTRIG_MUTEX_INTERPOSE=ON).
+extern "C" __attribute__((noinline)) int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept {
+    int rc = pthread_mutex_trylock(mutex);
+    return rc == EBUSY ? LockProfiler::lockContended(mutex, __builtin_return_address(0)) : rc;
+}
+
+static const bool cosMutexInterposed = (LockProfiler::interposed = true);
+#endif
+
+#if defined(COS_THROW_HOOK) && !defined(_WIN32)
+// Wraps the C++ runtime's __cxa_throw so COS sees every throw at its origin. Define COS_THROW_HOOK in
+// exactly one translation unit of the program (libcrash is built with it).
+namespace __cxxabiv1 {
+extern "C" void __cxa_throw(void* object, std::type_info* type, void (*destructor)(void*)) {
+    using ThrowFn = void (*)(void*, std::type_info*, void (*)(void*));
+    static ThrowFn next = reinterpret_cast<ThrowFn>(dlsym(RTLD_NEXT, "__cxa_throw"));
+    COS::noteThrow(object, type);
+    next(object, type, destructor);
+    std::abort();
+}
+}
+#endif
+
 #endif // COS_H
@@ -0,0 +1,62 @@
+#include "cosec.h"
+
+// Out-of-process crash reporter: the crashed app hands its record over on fd 3 (CrashReportChannel)
+// and exits, this process owns the COSEC dialog from there. It also fetches the debug info the crash
+// left pending in its log; `cosec-reporter --resolve <log>` does only that, for a later triage run.
+int main(int argc, char* argv[]) {
+    if (argc == 3 && std::string(argv[1]) == "--resolve") {
+        int resolved = COS::resolvePendingFrames(argv[2]);
+        if (resolved < 0) std::cerr << "cosec-reporter: nothing pending in " << argv[2] << std::endl;
+        else std::cout << "cosec-reporter: " << resolved << " frames resolved into " << argv[2] << std::endl;
+        return resolved > 0 ? 0 : 1;
+    }
+
+    int fd = CrashReportChannel::REPORTER_FD;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--fd") fd = std::atoi(argv[i + 1]);
+    }
+
+    const CrashReportChannel::Record* record = CrashReportChannel::attach(fd);
+    if (!record) {
+        std::cerr << "cosec-reporter: no crash record on fd " << fd << std::endl;
+        return 1;
+    }
+    close(fd);
+
+    QApplication app(argc, argv);
+    app.setApplicationName(QString::fromUtf8(record->executableName));
+
+    // the dialog does not wait for the servers, the resolved frames go into the log when they come
+    std::string logPath = record->logPath;
+    std::thread([logPath]() { COS::resolvePendingFrames(logPath); }).detach();
+
+    CrashInfo info = CrashReportChannel::toCrashInfo(record);
+    COSEC* dialog = new COSEC(info, QString::fromUtf8(record->executablePath),
+                              QIcon::fromTheme(QString::fromUtf8(record->iconName)),
+                              QString::fromUtf8(record->windowTitle));
+    dialog->setRestartHandler([dialog, record]() {
+        if (!CrashReportChannel::relaunch(record)) {
+            QMessageBox::warning(dialog, "Error", "Failed to restart the application.");
+            return;
+        }
+        dialog->accept();
+    });
+    QObject::connect(dialog, &QDialog::finished, &app, &QApplication::quit);
+    dialog->show();
+
+    QTimer::singleShot(0, [record]() {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long shownNs = static_cast<long long>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+        double latencyMs = (shownNs - record->crashMonotonicNs) / 1e6;
+
+        std::cout << "cosec-reporter: report shown " << latencyMs << " ms after the crash" << std::endl;
+        std::ofstream log(record->logPath, std::ios::app);
+        if (log.is_open()) {
+            log << "Reporter: crash report shown " << latencyMs << " ms after the signal (pid "
+                << getpid() << ")\n";
+        }
+    });
+
+    return app.exec();
+}
@@ -34,6 +34,11 @@ private:
     inline CrashOrgMan() : logger(nullptr), mainWindow(nullptr), crashHandlerActive(false) {
         logger = new COS();
         logger->setCrashCallback([this](const CrashInfo& info) { handleCrash(info); });
+#ifndef _WIN32
+        // out-of-process report when cosec-reporter is installed, in-process dialog otherwise
+        const char* reporter = std::getenv("COSEC_REPORTER");
+        logger->setCrashReporter(reporter ? reporter : COS_REPORTER_PATH);
+#endif
     }
 
     inline ~CrashOrgMan() { delete logger; }
@@ -48,9 +53,16 @@ public:
 
     inline void registerWindow(QMainWindow* win) {
         if (win) {
+            bool first = mainWindow == nullptr;
             mainWindow = win;
-            windowIcon = win->windowIcon();
-            windowTitle = win->windowTitle();
+            QObject::connect(win, &QWidget::windowTitleChanged, [this]() { updateWindowInfo(); });
+            QObject::connect(win, &QWidget::windowIconChanged, [this]() { updateWindowInfo(); });
+            updateWindowInfo();
+#ifndef _WIN32
+            if (first) {
+                QTimer::singleShot(0, [this]() { logger->reportRestartLatency("main window shown"); });
+            }
+#endif
         }
     }
 
@@ -58,6 +70,10 @@ public:
         if (mainWindow) {
             windowIcon = mainWindow->windowIcon();
             windowTitle = mainWindow->windowTitle();
+#ifndef _WIN32
+            // the reporter process cannot ask the dead window, keep its copy current
+            logger->setReporterWindow(windowTitle.toStdString(), windowIcon.name().toStdString());
+#endif
         }
     }
 
@@ -77,6 +93,7 @@ private:
     QString applicationPath;
     QIcon windowIcon;
     QString windowTitle;
+    std::function<void()> restartHandler;
 
     inline void setupUI() {
         setWindowTitle(QString::fromStdString(crashInfo.executableName) + " - Crash Report");
@@ -233,6 +250,72 @@ private:
         addDetail("Started", QString::fromStdString(crashInfo.startTime));
         addDetail("Crashed", QString::fromStdString(crashInfo.timestamp));
         addDetail("Log File", QString::fromStdString(crashInfo.logPath));
+        if (!crashInfo.snapshotPath.empty()) {
+            addDetail("Snapshot", QString::fromStdString(crashInfo.snapshotPath));
+        }
+
+        if (!crashInfo.exceptionType.empty()) {
+            QString exception = QString::fromStdString(crashInfo.exceptionType);
+            if (!crashInfo.exceptionWhat.empty()) exception += ": " + QString::fromStdString(crashInfo.exceptionWhat);
+            addDetail("Uncaught Exception", exception.toHtmlEscaped());
+        }
+
+        for (const auto& annotation : crashInfo.annotations) {
+            QLabel* lbl = new QLabel(QString("<b>%1:</b> %2")
+                                         .arg(QString::fromStdString(annotation.first).toHtmlEscaped())
+                                         .arg(QString::fromStdString(annotation.second).toHtmlEscaped()));
+            lbl->setWordWrap(true);
+            lbl->setTextInteractionFlags(Qt::TextSelectableByMouse);
+            rightLayout->addWidget(lbl);
+        }
+
+        if (!crashInfo.signalCodeName.empty()) {
+            auto hex = [](unsigned long long value) {
+                return QString("0x%1").arg(value, 16, 16, QChar('0'));
+            };
+
+            rightLayout->addSpacing(10);
+            QString fault = QString::fromStdString(crashInfo.signalCodeName);
+            if (!crashInfo.faultDescription.empty()) {
+                fault += " (" + QString::fromStdString(crashInfo.faultDescription) + ")";
+            }
+            addDetail("Fault", fault);
+            addDetail("Fault Address", hex(crashInfo.faultAddress));
+            addDetail("PC", hex(crashInfo.programCounter));
+            addDetail("SP", hex(crashInfo.stackPointer));
+
+            QString regs;
+            for (size_t i = 0; i < crashInfo.registers.size(); i++) {
+                regs += QString("%1 %2").arg(QString::fromStdString(crashInfo.registers[i].first), 7)
+                            .arg(hex(crashInfo.registers[i].second));
+                regs += (i % 2 == 1) ? "\n" : "   ";
+            }
+            QLabel* regLabel = new QLabel(regs);
+            regLabel->setFont(QFont("Monospace", 8));
+            regLabel->setTextInteractionFlags(Qt::TextSelectableByMouse);
+            rightLayout->addWidget(regLabel);
+        }
+
+        if (!crashInfo.breadcrumbs.empty()) {
+            rightLayout->addSpacing(10);
+            rightLayout->addWidget(new QLabel("<b>Breadcrumbs:</b>"));
+
+            QString crumbs;
+            size_t first = crashInfo.breadcrumbs.size() > 12 ? crashInfo.breadcrumbs.size() - 12 : 0;
+            for (size_t i = first; i < crashInfo.breadcrumbs.size(); i++) {
+                const CrashInfo::Breadcrumb& crumb = crashInfo.breadcrumbs[i];
+                crumbs += QString("%1 ms  %2 #%3  %4 %5\n")
+                              .arg(-crumb.agoUs / 1000.0, 9, 'f', 3)
+                              .arg(QString::fromStdString(crumb.category))
+                              .arg(crumb.id)
+                              .arg(crumb.a)
+                              .arg(crumb.b);
+            }
+            QLabel* crumbLabel = new QLabel(crumbs.trimmed());
+            crumbLabel->setFont(QFont("Monospace", 8));
+            crumbLabel->setTextInteractionFlags(Qt::TextSelectableByMouse);
+            rightLayout->addWidget(crumbLabel);
+        }
 
         rightLayout->addSpacing(20);
 
@@ -296,6 +379,11 @@ private:
         if (crashInfo.stackTrace.empty()) {
             stackText->setPlainText("No stack trace available (Windows or unavailable backtrace)");
             stackText->setStyleSheet("background-color: #f5f5f5; color: #888;");
+        } else if (!crashInfo.throwSiteTrace.empty()) {
+            // the abort trace only shows the runtime, lead with where the exception came from
+            stackText->setPlainText("Thrown at (" + QString::fromStdString(crashInfo.exceptionType) + "):\n" +
+                                    QString::fromStdString(crashInfo.throwSiteTrace) + "\nAborted at:\n" +
+                                    QString::fromStdString(crashInfo.stackTrace));
         } else {
             stackText->setPlainText(QString::fromStdString(crashInfo.stackTrace));
         }
@@ -338,7 +426,11 @@ private:
             );
 
         connect(restartBtn, &QPushButton::clicked, [this]() {
-            COS::Tri_reset();
+            if (restartHandler) {
+                restartHandler();
+            } else {
+                COS::Tri_reset();
+            }
         });
 
         connect(closeBtn, &QPushButton::clicked, [this]() {
@@ -360,6 +452,8 @@ public:
         : QDialog(nullptr), crashInfo(info), applicationPath(path), windowIcon(icon), windowTitle(title) {
         setupUI();
     }
+
+    inline void setRestartHandler(std::function<void()> handler) { restartHandler = handler; }
 };
 inline void CrashOrgMan::handleCrash(const CrashInfo& crashInfo) {
     if (crashHandlerActive) {
@@ -388,6 +482,8 @@ inline void CrashOrgMan::handleCrash(const CrashInfo& crashInfo) {
     });
 
     dialog->show();
+    // first event loop turn means the report is on screen, stop the crash watchdog
+    QTimer::singleShot(0, [this]() { logger->disarmWatchdog(); });
     dialog->exec();
     std::exit(0);
 }